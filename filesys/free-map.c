@@ -4,6 +4,7 @@
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
+#include "threads/malloc.h"
 
 static struct file *free_map_file;   /* Free map file. */
 static struct bitmap *free_map;      /* Free map, one bit per disk sector. */
@@ -11,9 +12,20 @@ static struct bitmap *free_map;      /* Free map, one bit per disk sector. */
 /* Initializes the free map. */
 void
 free_map_init (void) {
+	size_t sum_size;
+	void *summary;
+
 	free_map = bitmap_create (disk_size (filesys_disk));
 	if (free_map == NULL)
 		PANIC ("bitmap creation failed--disk is too large");
+
+	/* Let allocations skip over fully used stretches of a large
+	   disk.  The summary is only an accelerator, so go on without
+	   it if there is no memory for it. */
+	sum_size = bitmap_summary_size (disk_size (filesys_disk));
+	summary = malloc (sum_size);
+	if (summary != NULL)
+		bitmap_attach_summary (free_map, summary, sum_size);
 	bitmap_mark (free_map, FREE_MAP_SECTOR);
 	bitmap_mark (free_map, ROOT_DIR_SECTOR);
 }
@@ -36,6 +36,10 @@ enum {
 
 	SYS_MOUNT,
 	SYS_UMOUNT,
+
+	/* Extra for Project 3 */
+	SYS_MADVISE,                /* Advise how memory will be used. */
+	SYS_VMSTAT,                 /* Report virtual memory statistics. */
 };
 
 #endif /* lib/syscall-nr.h */
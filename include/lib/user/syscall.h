@@ -5,6 +5,8 @@
 #include <debug.h>
 #include <stddef.h>
 
+struct vmstat;
+
 /* Process identifier. */
 typedef int pid_t;
 #define PID_ERROR ((pid_t) -1)
@@ -41,6 +43,8 @@ int dup2(int oldfd, int newfd);
 /* Project 3 and optionally project 4. */
 void *mmap (void *addr, size_t length, int writable, int fd, off_t offset);
 void munmap (void *addr);
+int madvise (void *addr, size_t length, int advice);
+int vmstat (struct vmstat *st);
 
 /* Project 4 only. */
 bool chdir (const char *dir);
@@ -0,0 +1,45 @@
+#ifndef __LIB_VMSTAT_H
+#define __LIB_VMSTAT_H
+
+/* Advice for SYS_MADVISE. */
+enum {
+	MADV_NORMAL,                /* No special treatment. */
+	MADV_RANDOM,                /* Pages will be used in random order. */
+	MADV_SEQUENTIAL,            /* Pages will be used in order. */
+	MADV_WILLNEED,              /* Pages will be used soon. */
+	MADV_DONTNEED,              /* Pages will not be used soon. */
+};
+
+/* Kinds of page fault counted by SYS_VMSTAT. */
+enum {
+	VMSTAT_FAULT_UNINIT,        /* First touch of a lazily loaded page. */
+	VMSTAT_FAULT_ANON,          /* Anonymous page still in its frame. */
+	VMSTAT_FAULT_FILE,          /* File-backed page. */
+	VMSTAT_FAULT_SWAPIN,        /* Anonymous page back from swap. */
+	VMSTAT_FAULT_STACK,         /* Stack growth. */
+	VMSTAT_FAULT_WP,            /* Write to a write-protected page. */
+	VMSTAT_FAULT_CNT
+};
+
+/* Buckets of the fault latency histogram: bucket I counts faults
+ * that took from 2**I up to 2**(I+1) processor cycles to handle, the
+ * last one everything slower. */
+#define VMSTAT_HIST_CNT 32
+
+/* Filled in by SYS_VMSTAT.  Counts are since boot. */
+struct vmstat {
+	long long faults[VMSTAT_FAULT_CNT];  /* Faults handled, by kind. */
+	long long bad_faults;       /* Faults that killed the process. */
+	long long evictions;        /* Frames evicted. */
+	long long swap_ins;         /* Pages read from swap. */
+	long long swap_outs;        /* Pages written to swap. */
+	long long writebacks;       /* Dirty file pages written back. */
+	long long frames;           /* Frames in the frame table now... */
+	long long frames_peak;      /* ...and at most. */
+	long long pool_free[2];     /* Free pages in the kernel and user pools. */
+	long long pool_borrowed[2]; /* Pages each holds of the other. */
+	long long pool_empty[2];    /* Requests each could not serve itself. */
+	long long latency[VMSTAT_HIST_CNT];  /* Fault handling cycles. */
+};
+
+#endif /* lib/vmstat.h */
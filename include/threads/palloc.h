@@ -1,6 +1,7 @@
 #ifndef THREADS_PALLOC_H
 #define THREADS_PALLOC_H
 
+#include <stdbool.h>
 #include <stdint.h>
 #include <stddef.h>
 
@@ -14,10 +15,30 @@ enum palloc_flags {
 /* Maximum number of pages to put in user pool. */
 extern size_t user_page_limit;
 
+/* Borrowing between the pools; see palloc.c. */
+extern size_t palloc_borrow_max;
+extern size_t palloc_reserve;
+
+/* State of one pool, for palloc_get_stats(). */
+struct palloc_stats {
+	size_t page_cnt;            /* Pages in the pool. */
+	size_t free_cnt;            /* ...of which free. */
+	size_t borrowed_cnt;        /* Pages it holds of the other pool. */
+	size_t lent_cnt;            /* Pages the other pool holds of it. */
+	long long empty_cnt;        /* Requests it could not serve itself... */
+	long long borrow_cnt;       /* ...that the other pool served. */
+};
+
 uint64_t palloc_init (void);
 void *palloc_get_page (enum palloc_flags);
 void *palloc_get_multiple (enum palloc_flags, size_t page_cnt);
+void *palloc_get_aligned (enum palloc_flags, size_t page_cnt, size_t align);
 void palloc_free_page (void *);
 void palloc_free_multiple (void *, size_t page_cnt);
+bool palloc_prezero_page (void);
+size_t palloc_user_free_cnt (void);
+bool palloc_compact (size_t page_cnt, size_t align);
+void palloc_get_stats (enum palloc_flags, struct palloc_stats *);
+void palloc_print_stats (void);
 
 #endif /* threads/palloc.h */
@@ -41,5 +41,11 @@
 #define PTE_U 0x4                        /* 1=user/kernel, 0=kernel only. */
 #define PTE_A 0x20                       /* 1=accessed, 0=not acccessed. */
 #define PTE_D 0x40                       /* 1=dirty, 0=not dirty (PTEs only). */
+#define PTE_PS 0x80                      /* 1=large page (PDEs and PDPEs only). */
+
+/* Sizes of the large pages a PDE (2 MB) or a PDPE (1 GB) with
+   PTE_PS set maps. */
+#define PGSIZE_2M (1UL << PDXSHIFT)
+#define PGSIZE_1G (1UL << PDPESHIFT)
 
 #endif /* threads/pte.h */
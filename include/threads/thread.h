@@ -191,6 +191,7 @@ struct thread {
 #ifdef VM
   /* Table for whole virtual memory owned by thread. */
   struct supplemental_page_table spt;
+  void *user_rsp; /* system call 진입 시의 user rsp (stack growth 판단용) */
 #endif
 
   /* Owned by thread.c. */
@@ -257,6 +258,7 @@ void thread_yield(void);
 
 int thread_get_priority(void);
 void thread_set_priority(int);
+void thread_set_priority_of(struct thread *, int);
 
 int thread_get_nice(void);
 void thread_set_nice(int);
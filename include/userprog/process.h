@@ -8,6 +8,7 @@ tid_t process_fork (const char *name, struct intr_frame *if_);
 int process_exec (void *f_name);
 int process_wait (tid_t);
 void process_exit (void);
+void process_reap (struct thread *);
 void process_activate (struct thread *next);
 
 #endif /* userprog/process.h */
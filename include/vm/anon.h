@@ -1,13 +1,38 @@
 #ifndef VM_ANON_H
 #define VM_ANON_H
+#include <stddef.h>
 #include "vm/vm.h"
 struct page;
+struct zswap_entry;
+struct vmstat;
 enum vm_type;
 
 struct anon_page {
+	/* Swap slot holding a copy of the page, or BITMAP_ERROR.  The
+	 * slot is kept after swap-in, so that the page can be evicted
+	 * again without a write as long as it stays clean. */
+	size_t slot;
+
+	/* Compressed copy in the zswap pool, if not NULL.  A page out of
+	 * memory has either this or a slot.  Both may be shared with
+	 * forked copies of the page. */
+	struct zswap_entry *zentry;
+	struct list_elem zelem;     /* In ZENTRY's list of pages. */
+
+	/* For a private page of a file, such as program data: how it was
+	 * loaded, so that it can be again after MADV_DONTNEED.  LOAD is
+	 * NULL for pages that start out as zeros. */
+	vm_initializer *init;
+	struct lazy_load_arg *load;
 };
 
 void vm_anon_init (void);
 bool anon_initializer (struct page *page, enum vm_type type, void *kva);
+bool anon_swapped_next_to (struct page *page, struct page *base, long delta);
+bool anon_write_slot (struct page *page, const void *kva);
+bool anon_share_slot (struct page *page, const struct page *src);
+bool anon_share_swap (struct page *page, struct page *src);
+void anon_print_stats (void);
+void anon_vmstat (struct vmstat *st);
 
 #endif
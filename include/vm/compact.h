@@ -0,0 +1,17 @@
+#ifndef VM_COMPACT_H
+#define VM_COMPACT_H
+#include <stdbool.h>
+#include <stddef.h>
+
+struct bitmap;
+
+/* Milliseconds kcompactd sleeps between runs.  Zero, the default,
+ * leaves it out; compaction then only happens when an allocation
+ * fails. */
+extern unsigned compact_sleep_ms;
+
+void compact_init (void);
+bool compact_migrate (void *start, size_t page_cnt, struct bitmap *owned);
+void compact_print_stats (void);
+
+#endif
@@ -4,13 +4,29 @@
 #include "vm/vm.h"
 
 struct page;
+struct supplemental_page_table;
+struct vmstat;
 enum vm_type;
 
 struct file_page {
+	struct file *file;          /* Own reopened file. */
+	off_t ofs;                  /* Offset of the contents in FILE. */
+	size_t read_bytes;          /* Bytes read from FILE... */
+	size_t zero_bytes;          /* ...followed by this many zeros. */
+	size_t map_cnt;             /* Pages of the mapping it starts, or 0. */
+	bool text;                  /* Program code, in the text cache. */
 };
 
 void vm_file_init (void);
 bool file_backed_initializer (struct page *page, enum vm_type type, void *kva);
+bool file_page_dup (struct page *page, const struct page *src);
+struct frame *file_text_find (struct page *page);
+void file_text_add (struct frame *frame, struct page *page);
+void file_text_drop (struct frame *frame);
+void file_writeback (struct supplemental_page_table *spt, void *start,
+		void *end);
+void file_print_stats (void);
+void file_vmstat (struct vmstat *st);
 void *do_mmap(void *addr, size_t length, int writable,
 		struct file *file, off_t offset);
 void do_munmap (void *va);
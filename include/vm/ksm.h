@@ -0,0 +1,19 @@
+#ifndef VM_KSM_H
+#define VM_KSM_H
+#include <stddef.h>
+
+struct frame;
+
+/* Frames ksmd scans each time it wakes up.  Zero, the default,
+ * leaves same-page merging off. */
+extern size_t ksm_scan_pages;
+
+/* Milliseconds ksmd sleeps between scans. */
+extern unsigned ksm_sleep_ms;
+
+void ksm_init (void);
+void ksm_frame_removed (struct frame *frame);
+void ksm_forget (struct frame *frame);
+void ksm_print_stats (void);
+
+#endif
@@ -1,12 +1,29 @@
 #ifndef VM_UNINIT_H
 #define VM_UNINIT_H
 #include "vm/vm.h"
+#include "filesys/off_t.h"
 
 struct page;
+struct file;
 enum vm_type;
 
 typedef bool vm_initializer (struct page *, void *aux);
 
+/* AUX of pages whose contents come from a file: READ_BYTES bytes
+ * of FILE starting at OFS, followed by ZERO_BYTES zero bytes.  The
+ * page owns FILE (a private file_reopen() of the original) and the
+ * struct itself; both are released once the page is loaded or
+ * destroyed.  MAP_CNT is the number of pages of a memory mapping in
+ * its first page, and 0 otherwise. */
+struct lazy_load_arg {
+	struct file *file;
+	off_t ofs;
+	size_t read_bytes;
+	size_t zero_bytes;
+	size_t map_cnt;
+	bool text;      /* Program code, sharable (see vm/file.c). */
+};
+
 /* Uninitlialized page. The type for implementing the
  * "Lazy loading". */
 struct uninit_page {
@@ -21,4 +38,7 @@ struct uninit_page {
 void uninit_new (struct page *page, void *va, vm_initializer *init,
 		enum vm_type type, void *aux,
 		bool (*initializer)(struct page *, enum vm_type, void *kva));
+bool uninit_preloaded (struct page *page, void *kva);
+struct lazy_load_arg *lazy_load_arg_dup (const struct lazy_load_arg *);
+void lazy_load_arg_free (struct lazy_load_arg *);
 #endif
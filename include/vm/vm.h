@@ -1,6 +1,9 @@
 #ifndef VM_VM_H
 #define VM_VM_H
 #include <stdbool.h>
+#include <hash.h>
+#include <list.h>
+#include "threads/synch.h"
 #include "threads/palloc.h"
 
 enum vm_type {
@@ -20,6 +23,9 @@ enum vm_type {
 	VM_MARKER_0 = (1 << 3),
 	VM_MARKER_1 = (1 << 4),
 
+	/* Page belongs to the user stack. */
+	VM_STACK = VM_MARKER_0,
+
 	/* DO NOT EXCEED THIS VALUE. */
 	VM_MARKER_END = (1 << 31),
 };
@@ -46,6 +52,11 @@ struct page {
 	struct frame *frame;   /* Back reference for frame */
 
 	/* Your implementation */
+	struct thread *owner;       /* Thread whose address space holds VA. */
+	bool writable;              /* May the user write to the page? */
+	int advice;                 /* MADV_* given by madvise(). */
+	bool unmapped;              /* PTE already cleared and flushed. */
+	struct list_elem rmap_elem; /* Element in FRAME's rmap. */
 
 	/* Per-type data are binded into the union.
 	 * Each function automatically detects the current union */
@@ -63,8 +74,45 @@ struct page {
 struct frame {
 	void *kva;
 	struct page *page;
+	struct list_elem elem;      /* Element in the frame table. */
+
+	/* Reverse map: the pages mapping this frame, and how many there
+	 * are (see vm.c).  More than one share it after a fork, through
+	 * same-page merging or in the text cache; such a frame is mapped
+	 * read-only everywhere.  PAGE is one of them, NULL if none. */
+	struct list rmap;
+	int share_cnt;
+
+	/* Kept out of eviction while set, by a thread that needs the
+	 * frame's contents across a call that may evict. */
+	bool pinned;
+
+	/* Same-page merging (see vm/ksm.c). */
+	struct hash_elem ksm_elem;  /* Element in a ksm table. */
+	uint64_t ksm_sum;           /* Checksum at the last scan. */
+	enum ksm_state {
+		KSM_NONE,               /* In no table. */
+		KSM_UNSTABLE,           /* Candidate seen in this pass. */
+		KSM_STABLE              /* Merged into; read-only. */
+	} ksm_state;
+
+	/* Entry in the text cache of shared read-only file frames, or
+	 * NULL (see vm/file.c). */
+	struct text_frame *text;
+
+	/* While the frame is one of the 512 of a transparent huge page,
+	 * the page table set aside for splitting it; otherwise NULL. */
+	uint64_t *huge_pt;
 };
 
+/* The frame table and the zero page, for the frame scanners in
+ * vm/.  See vm.c. */
+extern struct list frame_table;
+extern struct lock frame_lock;
+extern struct frame zero_frame;
+void frame_get (struct frame *frame, struct page *page);
+void frame_put (struct frame *frame, struct page *page);
+
 /* The function table for page operations.
  * This is one way of implementing "interface" in C.
  * Put the table of "method" into the struct's member, and
@@ -85,6 +133,26 @@ struct page_operations {
  * We don't want to force you to obey any specific design for this struct.
  * All designs up to you for this. */
 struct supplemental_page_table {
+	/* Root of a radix tree of struct page, indexed by virtual page
+	 * number (see vm.c), or NULL if empty. */
+	void *root;
+
+	/* Held by the owner while changing the tree, so that other threads
+	 * (evicting one of the pages) may look around in it. */
+	struct lock lock;
+
+	/* Fault-around state (see fault_around() in vm.c): the page a
+	 * sequential fault would hit next, and the pages to load after
+	 * the next faulting page. */
+	void *fault_next;
+	size_t fault_window;
+
+	/* Stack growth state (see vm_stack_growth() in vm.c): the lowest
+	 * page of the stack, the pages to map below the next growth
+	 * fault, and the timer tick of the last one. */
+	void *stack_bottom;
+	size_t stack_window;
+	int64_t stack_tick;
 };
 
 #include "threads/thread.h"
@@ -92,10 +160,25 @@ void supplemental_page_table_init (struct supplemental_page_table *spt);
 bool supplemental_page_table_copy (struct supplemental_page_table *dst,
 		struct supplemental_page_table *src);
 void supplemental_page_table_kill (struct supplemental_page_table *spt);
+bool supplemental_page_table_shrink (struct supplemental_page_table *spt);
 struct page *spt_find_page (struct supplemental_page_table *spt,
 		void *va);
 bool spt_insert_page (struct supplemental_page_table *spt, struct page *page);
 void spt_remove_page (struct supplemental_page_table *spt, struct page *page);
+typedef bool spt_action_func (struct page *page, void *aux);
+bool spt_for_each (struct supplemental_page_table *spt, void *start,
+		void *end, spt_action_func *action, void *aux);
+
+/* Free frame watermarks for kswapd, set by -kswapd-low and
+ * -kswapd-high. */
+extern size_t kswapd_low;
+extern size_t kswapd_high;
+
+/* Transparent huge pages for anonymous memory, set by -thp. */
+extern bool thp_enabled;
+
+/* Pages the user stack may grow to, set by -stack-limit. */
+extern size_t stack_limit;
 
 void vm_init (void);
 bool vm_try_handle_fault (struct intr_frame *f, void *addr, bool user,
@@ -107,6 +190,10 @@ bool vm_alloc_page_with_initializer (enum vm_type type, void *upage,
 		bool writable, vm_initializer *init, void *aux);
 void vm_dealloc_page (struct page *page);
 bool vm_claim_page (void *va);
+bool vm_madvise (void *addr, size_t length, int advice);
+bool vm_vmstat (void *buf);
+void vm_free_frame (struct page *page);
+void vm_print_stats (void);
 enum vm_type page_get_type (struct page *page);
 
 #endif  /* VM_VM_H */
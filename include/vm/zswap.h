@@ -0,0 +1,20 @@
+#ifndef VM_ZSWAP_H
+#define VM_ZSWAP_H
+#include <stdbool.h>
+#include <stddef.h>
+
+struct page;
+struct zswap_entry;
+
+/* Size of the compressed swap pool, in kernel pages.  Zero, the
+ * default, leaves the pool out and swaps straight to disk. */
+extern size_t zswap_pool_pages;
+
+void zswap_init (void);
+bool zswap_store (struct page *page, const void *kva);
+bool zswap_load (struct page *page, void *kva);
+bool zswap_invalidate (struct page *page);
+bool zswap_share (struct page *page, struct page *src);
+void zswap_print_stats (void);
+
+#endif
@@ -3,6 +3,8 @@
 #include <limits.h>
 #include <round.h>
 #include <stdio.h>
+#include <string.h>
+#include "threads/interrupt.h"
 #include "threads/malloc.h"
 #ifdef FILESYS
 #include "filesys/file.h"
@@ -21,12 +23,26 @@ typedef unsigned long elem_type;
 /* Number of bits in an element. */
 #define ELEM_BITS (sizeof (elem_type) * CHAR_BIT)
 
+/* An element with every bit set. */
+#define ELEM_ALL ((elem_type) -1)
+
 /* From the outside, a bitmap is an array of bits.  From the
    inside, it's an array of elem_type (defined above) that
-   simulates an array of bits. */
+   simulates an array of bits.
+
+   A bitmap may optionally carry a summary (see
+   bitmap_attach_summary()): two more bit arrays with one bit per
+   element of BITS, telling whether that element is entirely set
+   (FULL) or entirely clear (EMPTY).  Scans use it to step over
+   whole runs of elements that cannot contain the bit they are
+   looking for.  While a summary is attached, every update of
+   BITS and the summary happens with interrupts off, so the pair
+   stays consistent on a uniprocessor. */
 struct bitmap {
 	size_t bit_cnt;     /* Number of bits. */
 	elem_type *bits;    /* Elements that represent bits. */
+	elem_type *full;    /* Summary: element is all ones, or NULL. */
+	elem_type *empty;   /* Summary: element is all zeros, or NULL. */
 };
 
 /* Returns the index of the element that contains the bit
@@ -63,6 +79,122 @@ last_mask (const struct bitmap *b) {
 	return last_bits ? ((elem_type) 1 << last_bits) - 1 : (elem_type) -1;
 }
 
+/* Returns an elem_type with the bits from bit OFS (counted within
+   an element) to the top of the element turned on. */
+static inline elem_type
+mask_from (size_t ofs) {
+	return ELEM_ALL << ofs;
+}
+
+/* Returns an elem_type with the bits below bit END (counted
+   within an element, 1 through ELEM_BITS) turned on. */
+static inline elem_type
+mask_below (size_t end) {
+	return end < ELEM_BITS ? ((elem_type) 1 << end) - 1 : ELEM_ALL;
+}
+
+/* Returns the number of bits set in X.  Written out instead of
+   using __builtin_popcountl(), which calls into libgcc unless the
+   compiler may assume the POPCNT instruction. */
+static inline size_t
+popcount (elem_type x) {
+	x = x - ((x >> 1) & 0x5555555555555555UL);
+	x = (x & 0x3333333333333333UL) + ((x >> 2) & 0x3333333333333333UL);
+	x = (x + (x >> 4)) & 0x0f0f0f0f0f0f0f0fUL;
+	return (x * 0x0101010101010101UL) >> 56;
+}
+
+/* Returns the index of the lowest set bit in X, which must not be
+   zero. */
+static inline size_t
+lowest_bit (elem_type x) {
+	return __builtin_ctzl (x);
+}
+
+/* Recomputes the summary bits of element IDX of B.  B must have
+   a summary and interrupts must be off. */
+static void
+summary_update (struct bitmap *b, size_t idx) {
+	elem_type word = b->bits[idx];
+	elem_type valid = idx == elem_cnt (b->bit_cnt) - 1 ? last_mask (b) : ELEM_ALL;
+	size_t sidx = elem_idx (idx);
+	elem_type smask = bit_mask (idx);
+
+	if ((word & valid) == valid)
+		b->full[sidx] |= smask;
+	else
+		b->full[sidx] &= ~smask;
+	if ((word & valid) == 0)
+		b->empty[sidx] |= smask;
+	else
+		b->empty[sidx] &= ~smask;
+}
+
+/* Atomically sets the bits of element IDX of B selected by MASK
+   to VALUE, keeping the summary (if any) up to date. */
+static void
+elem_set (struct bitmap *b, size_t idx, elem_type mask, bool value) {
+	enum intr_level old_level = INTR_ON;
+
+	if (b->full != NULL)
+		old_level = intr_disable ();
+
+	/* Atomic on a uniprocessor, like bitmap_mark() and
+	   bitmap_reset() below. */
+	if (value)
+		asm ("lock orq %1, %0" : "=m" (b->bits[idx]) : "r" (mask) : "cc");
+	else
+		asm ("lock andq %1, %0" : "=m" (b->bits[idx]) : "r" (~mask) : "cc");
+
+	if (b->full != NULL) {
+		summary_update (b, idx);
+		intr_set_level (old_level);
+	}
+}
+
+/* Returns the index of the first bit at or after START in B that
+   is set to VALUE, or B's size if there is none. */
+static size_t
+next_bit (const struct bitmap *b, size_t start, bool value) {
+	size_t cnt = elem_cnt (b->bit_cnt);
+	elem_type flip = value ? 0 : ELEM_ALL;
+	size_t idx = elem_idx (start);
+	size_t bit_idx;
+	elem_type word;
+
+	if (start >= b->bit_cnt)
+		return b->bit_cnt;
+
+	/* Part of the first element. */
+	word = (b->bits[idx] ^ flip) & mask_from (start % ELEM_BITS);
+	while (word == 0) {
+		if (++idx >= cnt)
+			return b->bit_cnt;
+
+		if (b->full != NULL) {
+			/* Elements that are all !VALUE hold nothing for us;
+			   jump over them through the summary. */
+			const elem_type *skip = value ? b->empty : b->full;
+			size_t sidx = elem_idx (idx);
+			elem_type cand = ~skip[sidx] & mask_from (idx % ELEM_BITS);
+
+			while (cand == 0) {
+				if (++sidx >= elem_cnt (cnt))
+					return b->bit_cnt;
+				cand = ~skip[sidx];
+			}
+			idx = sidx * ELEM_BITS + lowest_bit (cand);
+			if (idx >= cnt)
+				return b->bit_cnt;
+		}
+		word = b->bits[idx] ^ flip;
+	}
+
+	/* Padding bits past the end look clear; don't report them. */
+	bit_idx = idx * ELEM_BITS + lowest_bit (word);
+	return bit_idx < b->bit_cnt ? bit_idx : b->bit_cnt;
+}
+
 /* Creation and destruction. */
 
 /* Initializes B to be a bitmap of BIT_CNT bits
@@ -75,6 +207,7 @@ bitmap_create (size_t bit_cnt) {
 	if (b != NULL) {
 		b->bit_cnt = bit_cnt;
 		b->bits = malloc (byte_cnt (bit_cnt));
+		b->full = b->empty = NULL;
 		if (b->bits != NULL || bit_cnt == 0) {
 			bitmap_set_all (b, false);
 			return b;
@@ -95,6 +228,7 @@ bitmap_create_in_buf (size_t bit_cnt, void *block, size_t block_size UNUSED) {
 
 	b->bit_cnt = bit_cnt;
 	b->bits = (elem_type *) (b + 1);
+	b->full = b->empty = NULL;
 	bitmap_set_all (b, false);
 	return b;
 }
@@ -106,6 +240,39 @@ bitmap_buf_size (size_t bit_cnt) {
 	return sizeof (struct bitmap) + byte_cnt (bit_cnt);
 }
 
+/* Returns the number of bytes required for the summary of a
+   bitmap with BIT_CNT bits (for use with bitmap_attach_summary()). */
+size_t
+bitmap_summary_size (size_t bit_cnt) {
+	return 2 * byte_cnt (elem_cnt (bit_cnt));
+}
+
+/* Gives B a summary of which of its elements are entirely set or
+   entirely clear, stored in the BLOCK_SIZE bytes at BLOCK, which
+   must be at least bitmap_summary_size() bytes and remain owned
+   by the caller.  Afterwards bitmap_scan() skips full or empty
+   stretches of B without looking at them, which matters for
+   large, mostly used bitmaps; the price is that single-bit
+   updates briefly disable interrupts. */
+void
+bitmap_attach_summary (struct bitmap *b, void *block,
+		size_t block_size UNUSED) {
+	size_t scnt = elem_cnt (elem_cnt (b->bit_cnt));
+	enum intr_level old_level;
+	size_t i;
+
+	ASSERT (b != NULL);
+	ASSERT (block_size >= bitmap_summary_size (b->bit_cnt));
+
+	memset (block, 0, bitmap_summary_size (b->bit_cnt));
+	old_level = intr_disable ();
+	b->full = block;
+	b->empty = b->full + scnt;
+	for (i = 0; i < elem_cnt (b->bit_cnt); i++)
+		summary_update (b, i);
+	intr_set_level (old_level);
+}
+
 /* Destroys bitmap B, freeing its storage.
    Not for use on bitmaps created by
    bitmap_create_preallocated(). */
@@ -144,6 +311,11 @@ bitmap_mark (struct bitmap *b, size_t bit_idx) {
 	size_t idx = elem_idx (bit_idx);
 	elem_type mask = bit_mask (bit_idx);
 
+	if (b->full != NULL) {
+		elem_set (b, idx, mask, true);
+		return;
+	}
+
 	/* This is equivalent to `b->bits[idx] |= mask' except that it
 	   is guaranteed to be atomic on a uniprocessor machine.  See
 	   the description of the OR instruction in [IA32-v2b]. */
@@ -156,6 +328,11 @@ bitmap_reset (struct bitmap *b, size_t bit_idx) {
 	size_t idx = elem_idx (bit_idx);
 	elem_type mask = bit_mask (bit_idx);
 
+	if (b->full != NULL) {
+		elem_set (b, idx, mask, false);
+		return;
+	}
+
 	/* This is equivalent to `b->bits[idx] &= ~mask' except that it
 	   is guaranteed to be atomic on a uniprocessor machine.  See
 	   the description of the AND instruction in [IA32-v2a]. */
@@ -170,10 +347,20 @@ bitmap_flip (struct bitmap *b, size_t bit_idx) {
 	size_t idx = elem_idx (bit_idx);
 	elem_type mask = bit_mask (bit_idx);
 
+	enum intr_level old_level = INTR_ON;
+
+	if (b->full != NULL)
+		old_level = intr_disable ();
+
 	/* This is equivalent to `b->bits[idx] ^= mask' except that it
 	   is guaranteed to be atomic on a uniprocessor machine.  See
 	   the description of the XOR instruction in [IA32-v2b]. */
 	asm ("lock xorq %1, %0" : "=m" (b->bits[idx]) : "r" (mask) : "cc");
+
+	if (b->full != NULL) {
+		summary_update (b, idx);
+		intr_set_level (old_level);
+	}
 }
 
 /* Returns the value of the bit numbered IDX in B. */
@@ -194,50 +381,58 @@ bitmap_set_all (struct bitmap *b, bool value) {
 	bitmap_set_multiple (b, 0, bitmap_size (b), value);
 }
 
-/* Sets the CNT bits starting at START in B to VALUE. */
+/* Sets the CNT bits starting at START in B to VALUE.
+   Each element is updated atomically, but not the whole range. */
 void
 bitmap_set_multiple (struct bitmap *b, size_t start, size_t cnt, bool value) {
-	size_t i;
+	size_t end = start + cnt;
 
 	ASSERT (b != NULL);
 	ASSERT (start <= b->bit_cnt);
 	ASSERT (start + cnt <= b->bit_cnt);
 
-	for (i = 0; i < cnt; i++)
-		bitmap_set (b, start + i, value);
+	while (start < end) {
+		size_t ofs = start % ELEM_BITS;
+		size_t n = ELEM_BITS - ofs < end - start ? ELEM_BITS - ofs : end - start;
+
+		elem_set (b, elem_idx (start), mask_from (ofs) & mask_below (ofs + n),
+				value);
+		start += n;
+	}
 }
 
 /* Returns the number of bits in B between START and START + CNT,
    exclusive, that are set to VALUE. */
 size_t
 bitmap_count (const struct bitmap *b, size_t start, size_t cnt, bool value) {
-	size_t i, value_cnt;
+	size_t end = start + cnt;
+	size_t value_cnt;
 
 	ASSERT (b != NULL);
 	ASSERT (start <= b->bit_cnt);
 	ASSERT (start + cnt <= b->bit_cnt);
 
 	value_cnt = 0;
-	for (i = 0; i < cnt; i++)
-		if (bitmap_test (b, start + i) == value)
-			value_cnt++;
-	return value_cnt;
+	while (start < end) {
+		size_t ofs = start % ELEM_BITS;
+		size_t n = ELEM_BITS - ofs < end - start ? ELEM_BITS - ofs : end - start;
+		elem_type mask = mask_from (ofs) & mask_below (ofs + n);
+
+		value_cnt += popcount (b->bits[elem_idx (start)] & mask);
+		start += n;
+	}
+	return value ? value_cnt : cnt - value_cnt;
 }
 
 /* Returns true if any bits in B between START and START + CNT,
    exclusive, are set to VALUE, and false otherwise. */
 bool
 bitmap_contains (const struct bitmap *b, size_t start, size_t cnt, bool value) {
-	size_t i;
-
 	ASSERT (b != NULL);
 	ASSERT (start <= b->bit_cnt);
 	ASSERT (start + cnt <= b->bit_cnt);
 
-	for (i = 0; i < cnt; i++)
-		if (bitmap_test (b, start + i) == value)
-			return true;
-	return false;
+	return cnt > 0 && next_bit (b, start, value) < start + cnt;
 }
 
 /* Returns true if any bits in B between START and START + CNT,
@@ -272,12 +467,25 @@ bitmap_scan (const struct bitmap *b, size_t start, size_t cnt, bool value) {
 	ASSERT (b != NULL);
 	ASSERT (start <= b->bit_cnt);
 
+	if (cnt == 0)
+		return start;
 	if (cnt <= b->bit_cnt) {
 		size_t last = b->bit_cnt - cnt;
-		size_t i;
-		for (i = start; i <= last; i++)
-			if (!bitmap_contains (b, i, cnt, !value))
+		size_t i = start;
+
+		/* Jump from one run of VALUE bits to the next, a whole
+		   element at a time, instead of testing every start. */
+		for (;;) {
+			size_t run_end;
+
+			i = next_bit (b, i, value);
+			if (i > last)
+				break;
+			run_end = next_bit (b, i, !value);
+			if (run_end - i >= cnt)
 				return i;
+			i = run_end;
+		}
 	}
 	return BITMAP_ERROR;
 }
@@ -315,6 +523,8 @@ bitmap_read (struct bitmap *b, struct file *file) {
 		off_t size = byte_cnt (b->bit_cnt);
 		success = file_read_at (file, b->bits, size, 0) == size;
 		b->bits[elem_cnt (b->bit_cnt) - 1] &= last_mask (b);
+		if (b->full != NULL)
+			bitmap_attach_summary (b, b->full, bitmap_summary_size (b->bit_cnt));
 	}
 	return success;
 }
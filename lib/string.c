@@ -1,5 +1,113 @@
 #include <string.h>
 #include <debug.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/* The block functions below move data a word at a time instead of
+   a byte at a time.  On CPUs that advertise Enhanced REP MOVSB/
+   STOSB (ERMS) the string instructions themselves are faster for
+   anything but tiny blocks, so memcpy() and memset() use them
+   there.  Both the kernel and user programs link this file and
+   may execute CPUID, so the choice is made on first use rather
+   than from an init hook.
+
+   SSE is not an option: everything is built with -mno-sse and
+   the kernel does not save the XMM registers on a switch. */
+
+/* A 64-bit word that may alias any other type. */
+typedef uint64_t __attribute__ ((may_alias)) word_t;
+
+#define WORD_SIZE sizeof (word_t)
+#define WORD_MASK (WORD_SIZE - 1)
+
+/* Every byte of the word set to 0x01 and 0x80, respectively. */
+#define ONES  0x0101010101010101ULL
+#define HIGHS 0x8080808080808080ULL
+
+/* True if some byte of word X is zero. */
+#define HAS_ZERO(X) ((((X) - ONES) & ~(X) & HIGHS) != 0)
+
+/* Blocks shorter than this are not worth the startup cost of a
+   `rep' string instruction. */
+#define REP_THRESHOLD 64
+
+/* Whether the CPU has ERMS: -1 until probed, then 0 or 1. */
+static int erms = -1;
+
+/* Returns true if REP MOVSB/STOSB are the fastest way to move
+   blocks on this CPU.  See [IA32-v2a] "CPUID", leaf 7, EBX bit 9. */
+static bool
+has_erms (void) {
+	if (erms < 0) {
+		uint32_t eax, ebx, ecx, edx;
+
+		asm volatile ("cpuid"
+				: "=a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx)
+				: "a" (0));
+		if (eax >= 7) {
+			asm volatile ("cpuid"
+					: "=a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx)
+					: "a" (7), "c" (0));
+			erms = (ebx >> 9) & 1;
+		} else
+			erms = 0;
+	}
+	return erms;
+}
+
+/* Copies SIZE bytes forward from SRC to DST with `rep movsb'. */
+static inline void
+rep_movsb (unsigned char *dst, const unsigned char *src, size_t size) {
+	asm volatile ("rep movsb"
+			: "+D" (dst), "+S" (src), "+c" (size) : : "memory");
+}
+
+/* Fills SIZE bytes at DST with VALUE with `rep stosb'. */
+static inline void
+rep_stosb (unsigned char *dst, unsigned char value, size_t size) {
+	asm volatile ("rep stosb"
+			: "+D" (dst), "+c" (size) : "a" (value) : "memory");
+}
+
+/* Copies SIZE bytes forward from SRC to DST, aligning DST to a
+   word boundary and then moving whole words. */
+static void
+copy_forward (unsigned char *dst, const unsigned char *src, size_t size) {
+	if (size >= 2 * WORD_SIZE) {
+		while ((uintptr_t) dst & WORD_MASK) {
+			*dst++ = *src++;
+			size--;
+		}
+		for (; size >= WORD_SIZE; size -= WORD_SIZE) {
+			*(word_t *) dst = *(const word_t *) src;
+			dst += WORD_SIZE;
+			src += WORD_SIZE;
+		}
+	}
+	while (size-- > 0)
+		*dst++ = *src++;
+}
+
+/* Copies SIZE bytes backward from the ends of SRC and DST, for an
+   overlapping memmove() where DST is above SRC. */
+static void
+copy_backward (unsigned char *dst, const unsigned char *src, size_t size) {
+	dst += size;
+	src += size;
+	if (size >= 2 * WORD_SIZE) {
+		while ((uintptr_t) dst & WORD_MASK) {
+			*--dst = *--src;
+			size--;
+		}
+		for (; size >= WORD_SIZE; size -= WORD_SIZE) {
+			dst -= WORD_SIZE;
+			src -= WORD_SIZE;
+			*(word_t *) dst = *(const word_t *) src;
+		}
+	}
+	while (size-- > 0)
+		*--dst = *--src;
+}
 
 /* Copies SIZE bytes from SRC to DST, which must not overlap.
    Returns DST. */
@@ -11,8 +119,10 @@ memcpy (void *dst_, const void *src_, size_t size) {
 	ASSERT (dst != NULL || size == 0);
 	ASSERT (src != NULL || size == 0);
 
-	while (size-- > 0)
-		*dst++ = *src++;
+	if (size >= REP_THRESHOLD && has_erms ())
+		rep_movsb (dst, src, size);
+	else
+		copy_forward (dst, src, size);
 
 	return dst_;
 }
@@ -27,17 +137,13 @@ memmove (void *dst_, const void *src_, size_t size) {
 	ASSERT (dst != NULL || size == 0);
 	ASSERT (src != NULL || size == 0);
 
-	if (dst < src) {
-		while (size-- > 0)
-			*dst++ = *src++;
-	} else {
-		dst += size;
-		src += size;
-		while (size-- > 0)
-			*--dst = *--src;
-	}
+	/* A forward copy is safe unless DST starts inside SRC. */
+	if (dst <= src || dst >= src + size)
+		memcpy (dst, src, size);
+	else
+		copy_backward (dst, src, size);
 
-	return dst;
+	return dst_;
 }
 
 /* Find the first differing byte in the two blocks of SIZE bytes
@@ -52,6 +158,13 @@ memcmp (const void *a_, const void *b_, size_t size) {
 	ASSERT (a != NULL || size == 0);
 	ASSERT (b != NULL || size == 0);
 
+	/* Skip over the equal prefix a word at a time; the byte loop
+	   below then finds which byte of the first unequal word
+	   differs. */
+	for (; size >= WORD_SIZE; a += WORD_SIZE, b += WORD_SIZE, size -= WORD_SIZE)
+		if (*(const word_t *) a != *(const word_t *) b)
+			break;
+
 	for (; size-- > 0; a++, b++)
 		if (*a != *b)
 			return *a > *b ? +1 : -1;
@@ -260,6 +373,23 @@ memset (void *dst_, int value, size_t size) {
 
 	ASSERT (dst != NULL || size == 0);
 
+	if (size >= REP_THRESHOLD && has_erms ()) {
+		rep_stosb (dst, value, size);
+		return dst_;
+	}
+
+	if (size >= 2 * WORD_SIZE) {
+		word_t fill = (unsigned char) value * ONES;
+
+		while ((uintptr_t) dst & WORD_MASK) {
+			*dst++ = value;
+			size--;
+		}
+		for (; size >= WORD_SIZE; size -= WORD_SIZE) {
+			*(word_t *) dst = fill;
+			dst += WORD_SIZE;
+		}
+	}
 	while (size-- > 0)
 		*dst++ = value;
 
@@ -270,10 +400,21 @@ memset (void *dst_, int value, size_t size) {
 size_t
 strlen (const char *string) {
 	const char *p;
+	const word_t *w;
 
 	ASSERT (string);
 
-	for (p = string; *p != '\0'; p++)
+	/* Reach a word boundary a byte at a time.  After that, whole
+	   aligned words are read; an aligned word never straddles a
+	   page, so reading past the terminator cannot fault. */
+	for (p = string; (uintptr_t) p & WORD_MASK; p++)
+		if (*p == '\0')
+			return p - string;
+
+	for (w = (const word_t *) p; !HAS_ZERO (*w); w++)
+		continue;
+
+	for (p = (const char *) w; *p != '\0'; p++)
 		continue;
 	return p - string;
 }
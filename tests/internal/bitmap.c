@@ -0,0 +1,190 @@
+/* Test program and benchmark for lib/kernel/bitmap.c.
+
+   Runs random sequences of bitmap_set_multiple(), bitmap_flip(),
+   bitmap_count(), bitmap_contains() and bitmap_scan() against a
+   plain array of bools, with and without a summary attached.
+   Then fills a large bitmap to increasing levels and prints the
+   cycles taken by bitmap_scan() to find free runs, which should
+   stay flat as the bitmap fills up.
+
+   This is not a test we will run on your submitted projects.
+   It is here for completeness.
+*/
+
+#undef NDEBUG
+#include <bitmap.h>
+#include <debug.h>
+#include <random.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "threads/malloc.h"
+#include "threads/test.h"
+
+/* Largest bitmap that is checked against the reference. */
+#define MAX_BITS 1500
+
+/* Number of random operations per checked bitmap. */
+#define OPS 300
+
+/* Size of the benchmarked bitmap: one bit per page of 1 GB. */
+#define BENCH_BITS (1024 * 1024 * 1024 / 4096)
+
+static bool ref[MAX_BITS];
+
+static void check (bool summary);
+static void bench (bool summary);
+
+/* Test the bitmap implementation. */
+void
+test (void)
+{
+  printf ("testing bitmap without summary...");
+  check (false);
+  printf (" done\n");
+  printf ("testing bitmap with summary...");
+  check (true);
+  printf (" done\n");
+
+  bench (false);
+  bench (true);
+}
+
+/* Returns a random number between 0 and N - 1, or 0 if N is 0. */
+static size_t
+rand_below (size_t n)
+{
+  return n ? random_ulong () % n : 0;
+}
+
+/* Reference bitmap_scan() on REF. */
+static size_t
+ref_scan (size_t bit_cnt, size_t start, size_t cnt, bool value)
+{
+  size_t i, j;
+
+  if (cnt == 0)
+    return start;
+  for (i = start; cnt <= bit_cnt && i <= bit_cnt - cnt; i++)
+    {
+      for (j = 0; j < cnt && ref[i + j] == value; j++)
+        continue;
+      if (j == cnt)
+        return i;
+    }
+  return BITMAP_ERROR;
+}
+
+static void
+check (bool summary)
+{
+  int trial;
+
+  for (trial = 0; trial < 100; trial++)
+    {
+      size_t bit_cnt = rand_below (MAX_BITS);
+      struct bitmap *b = bitmap_create (bit_cnt);
+      void *sum = NULL;
+      size_t i;
+      int op;
+
+      ASSERT (b != NULL);
+      if (summary)
+        {
+          sum = malloc (bitmap_summary_size (bit_cnt));
+          ASSERT (sum != NULL);
+          bitmap_attach_summary (b, sum, bitmap_summary_size (bit_cnt));
+        }
+      for (i = 0; i < bit_cnt; i++)
+        ref[i] = false;
+
+      for (op = 0; op < OPS; op++)
+        {
+          size_t start = rand_below (bit_cnt + 1);
+          size_t cnt = rand_below (bit_cnt - start + 1);
+          size_t value_cnt, want;
+          bool value = random_ulong () & 1;
+
+          if (random_ulong () & 1)
+            {
+              bitmap_set_multiple (b, start, cnt, value);
+              for (i = 0; i < cnt; i++)
+                ref[start + i] = value;
+            }
+          else if (bit_cnt > 0)
+            {
+              i = rand_below (bit_cnt);
+              bitmap_flip (b, i);
+              ref[i] = !ref[i];
+            }
+
+          value_cnt = 0;
+          for (i = 0; i < cnt; i++)
+            value_cnt += ref[start + i] == value;
+          ASSERT (bitmap_count (b, start, cnt, value) == value_cnt);
+          ASSERT (bitmap_contains (b, start, cnt, value) == (value_cnt > 0));
+
+          want = rand_below (80);
+          ASSERT (bitmap_scan (b, start, want, value)
+                  == ref_scan (bit_cnt, start, want, value));
+        }
+
+      for (i = 0; i < bit_cnt; i++)
+        ASSERT (bitmap_test (b, i) == ref[i]);
+      bitmap_destroy (b);
+      free (sum);
+    }
+}
+
+/* Returns the processor's time-stamp counter. */
+static inline uint64_t
+rdtsc (void)
+{
+  uint32_t lo, hi;
+  asm volatile ("rdtsc" : "=a" (lo), "=d" (hi));
+  return ((uint64_t) hi << 32) | lo;
+}
+
+/* Fills a page-pool sized bitmap to 50%, 90%, 99% and 100% minus
+   one run, leaving the free runs at the end, and times scans for
+   runs of 1 and 16 free bits. */
+static void
+bench (bool summary)
+{
+  static const int fill[] = { 50, 90, 99, 100 };
+  struct bitmap *b = bitmap_create (BENCH_BITS);
+  void *sum = NULL;
+  size_t i;
+
+  ASSERT (b != NULL);
+  if (summary)
+    {
+      sum = malloc (bitmap_summary_size (BENCH_BITS));
+      ASSERT (sum != NULL);
+      bitmap_attach_summary (b, sum, bitmap_summary_size (BENCH_BITS));
+    }
+
+  printf ("bitmap_scan of %d bits, %s summary:\n", BENCH_BITS,
+          summary ? "with" : "without");
+  for (i = 0; i < sizeof fill / sizeof *fill; i++)
+    {
+      size_t used = (size_t) BENCH_BITS * fill[i] / 100 - 16;
+      uint64_t one, run;
+
+      bitmap_set_all (b, false);
+      bitmap_set_multiple (b, 0, used, true);
+
+      one = rdtsc ();
+      ASSERT (bitmap_scan (b, 0, 1, false) == used);
+      one = rdtsc () - one;
+
+      run = rdtsc ();
+      ASSERT (bitmap_scan (b, 0, 16, false) == used);
+      run = rdtsc () - run;
+
+      printf ("  %3d%% used: %10llu cycles (1 bit), %10llu cycles (16 bits)\n",
+              fill[i], one, run);
+    }
+
+  bitmap_destroy (b);
+  free (sum);
+}
@@ -0,0 +1,229 @@
+/* Test program and microbenchmark for the block functions in
+   lib/string.c.
+
+   Checks memcpy(), memmove(), memset(), memcmp() and strlen()
+   against trivial byte-at-a-time references for every size and
+   misalignment up to a few words, then times each function for
+   block sizes from 1 byte to 64 kB and prints cycles per call.
+
+   This is not a test we will run on your submitted projects.
+   It is here for completeness.
+*/
+
+#undef NDEBUG
+#include <debug.h>
+#include <random.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/test.h"
+
+/* Largest block that is benchmarked. */
+#define MAX_SIZE (64 * 1024)
+
+/* Largest block and misalignment checked for correctness. */
+#define CHECK_SIZE 80
+#define CHECK_ALIGN 8
+
+/* Number of timed calls per size. */
+#define ITERATIONS 64
+
+static uint8_t buf_a[MAX_SIZE + 64];
+static uint8_t buf_b[MAX_SIZE + 64];
+static uint8_t buf_ref[MAX_SIZE + 64];
+
+static void check_copy (void);
+static void check_move (void);
+static void check_set (void);
+static void check_cmp (void);
+static void check_strlen (void);
+static void bench (void);
+
+/* Test the block functions. */
+void
+test (void)
+{
+  printf ("testing memcpy..."); check_copy (); printf (" done\n");
+  printf ("testing memmove..."); check_move (); printf (" done\n");
+  printf ("testing memset..."); check_set (); printf (" done\n");
+  printf ("testing memcmp..."); check_cmp (); printf (" done\n");
+  printf ("testing strlen..."); check_strlen (); printf (" done\n");
+  bench ();
+}
+
+/* Fills the first CNT bytes of BUF with random bytes. */
+static void
+randomize (uint8_t *buf, size_t cnt)
+{
+  random_bytes (buf, cnt);
+}
+
+static void
+check_copy (void)
+{
+  size_t size, src_ofs, dst_ofs, i;
+
+  for (size = 0; size <= CHECK_SIZE; size++)
+    for (src_ofs = 0; src_ofs < CHECK_ALIGN; src_ofs++)
+      for (dst_ofs = 0; dst_ofs < CHECK_ALIGN; dst_ofs++)
+        {
+          randomize (buf_a, CHECK_SIZE + 2 * CHECK_ALIGN);
+          randomize (buf_b, CHECK_SIZE + 2 * CHECK_ALIGN);
+          for (i = 0; i < CHECK_SIZE + 2 * CHECK_ALIGN; i++)
+            buf_ref[i] = buf_b[i];
+          for (i = 0; i < size; i++)
+            buf_ref[dst_ofs + i] = buf_a[src_ofs + i];
+
+          ASSERT (memcpy (buf_b + dst_ofs, buf_a + src_ofs, size)
+                  == buf_b + dst_ofs);
+          for (i = 0; i < CHECK_SIZE + 2 * CHECK_ALIGN; i++)
+            ASSERT (buf_b[i] == buf_ref[i]);
+        }
+}
+
+static void
+check_move (void)
+{
+  size_t size, src_ofs, dst_ofs, i;
+
+  for (size = 0; size <= CHECK_SIZE; size++)
+    for (src_ofs = 0; src_ofs < 2 * CHECK_ALIGN; src_ofs++)
+      for (dst_ofs = 0; dst_ofs < 2 * CHECK_ALIGN; dst_ofs++)
+        {
+          randomize (buf_a, CHECK_SIZE + 4 * CHECK_ALIGN);
+          for (i = 0; i < CHECK_SIZE + 4 * CHECK_ALIGN; i++)
+            buf_ref[i] = buf_a[i];
+          for (i = 0; i < size; i++)
+            buf_b[i] = buf_a[src_ofs + i];
+          for (i = 0; i < size; i++)
+            buf_ref[dst_ofs + i] = buf_b[i];
+
+          /* Source and destination overlap in both directions. */
+          ASSERT (memmove (buf_a + dst_ofs, buf_a + src_ofs, size)
+                  == buf_a + dst_ofs);
+          for (i = 0; i < CHECK_SIZE + 4 * CHECK_ALIGN; i++)
+            ASSERT (buf_a[i] == buf_ref[i]);
+        }
+}
+
+static void
+check_set (void)
+{
+  size_t size, ofs, i;
+
+  for (size = 0; size <= CHECK_SIZE; size++)
+    for (ofs = 0; ofs < CHECK_ALIGN; ofs++)
+      {
+        int value = random_ulong () & 0xff;
+
+        randomize (buf_a, CHECK_SIZE + 2 * CHECK_ALIGN);
+        for (i = 0; i < CHECK_SIZE + 2 * CHECK_ALIGN; i++)
+          buf_ref[i] = i >= ofs && i < ofs + size ? value : buf_a[i];
+
+        ASSERT (memset (buf_a + ofs, value, size) == buf_a + ofs);
+        for (i = 0; i < CHECK_SIZE + 2 * CHECK_ALIGN; i++)
+          ASSERT (buf_a[i] == buf_ref[i]);
+      }
+}
+
+static void
+check_cmp (void)
+{
+  size_t size, ofs, diff;
+
+  for (size = 0; size <= CHECK_SIZE; size++)
+    for (ofs = 0; ofs < CHECK_ALIGN; ofs++)
+      {
+        randomize (buf_a, CHECK_SIZE + CHECK_ALIGN);
+        memcpy (buf_b + ofs, buf_a, size);
+        ASSERT (memcmp (buf_a, buf_b + ofs, size) == 0);
+
+        /* Flip one byte at a time; only that byte decides. */
+        for (diff = 0; diff < size; diff++)
+          {
+            uint8_t saved = buf_b[ofs + diff];
+
+            buf_b[ofs + diff] = buf_a[diff] + 1;
+            ASSERT (memcmp (buf_a, buf_b + ofs, size)
+                    == (buf_a[diff] > buf_b[ofs + diff] ? 1 : -1));
+            buf_b[ofs + diff] = saved;
+          }
+      }
+}
+
+static void
+check_strlen (void)
+{
+  size_t len, ofs;
+
+  for (len = 0; len <= CHECK_SIZE; len++)
+    for (ofs = 0; ofs < CHECK_ALIGN; ofs++)
+      {
+        memset (buf_a, 'x', CHECK_SIZE + 2 * CHECK_ALIGN);
+        buf_a[ofs + len] = '\0';
+        ASSERT (strlen ((char *) buf_a + ofs) == len);
+      }
+}
+
+/* Returns the processor's time-stamp counter. */
+static inline uint64_t
+rdtsc (void)
+{
+  uint32_t lo, hi;
+  asm volatile ("rdtsc" : "=a" (lo), "=d" (hi));
+  return ((uint64_t) hi << 32) | lo;
+}
+
+/* Times every block function at power-of-two sizes. */
+static void
+bench (void)
+{
+  size_t size;
+
+  memset (buf_a, 'x', MAX_SIZE);
+  memset (buf_b, 'x', MAX_SIZE);
+  buf_a[MAX_SIZE] = '\0';
+
+  printf ("%8s %10s %10s %10s %10s %10s\n", "bytes",
+          "memcpy", "memmove", "memset", "memcmp", "strlen");
+  for (size = 1; size <= MAX_SIZE; size *= 2)
+    {
+      uint64_t cycles[5];
+      uint64_t start;
+      int i;
+
+      start = rdtsc ();
+      for (i = 0; i < ITERATIONS; i++)
+        memcpy (buf_b, buf_a, size);
+      cycles[0] = rdtsc () - start;
+
+      start = rdtsc ();
+      for (i = 0; i < ITERATIONS; i++)
+        memmove (buf_a + 1, buf_a, size);
+      cycles[1] = rdtsc () - start;
+
+      start = rdtsc ();
+      for (i = 0; i < ITERATIONS; i++)
+        memset (buf_b, i, size);
+      cycles[2] = rdtsc () - start;
+
+      memset (buf_b, 'x', size);
+      memset (buf_a, 'x', size + 1);
+      start = rdtsc ();
+      for (i = 0; i < ITERATIONS; i++)
+        ASSERT (memcmp (buf_a, buf_b, size) == 0);
+      cycles[3] = rdtsc () - start;
+
+      buf_a[size] = '\0';
+      start = rdtsc ();
+      for (i = 0; i < ITERATIONS; i++)
+        ASSERT (strlen ((char *) buf_a) == size);
+      cycles[4] = rdtsc () - start;
+      buf_a[size] = 'x';
+
+      printf ("%8zu %10llu %10llu %10llu %10llu %10llu\n", size,
+              cycles[0] / ITERATIONS, cycles[1] / ITERATIONS,
+              cycles[2] / ITERATIONS, cycles[3] / ITERATIONS,
+              cycles[4] / ITERATIONS);
+    }
+}
@@ -0,0 +1,61 @@
+/* Fills most of a 1024-page user pool with single pages, gives
+ * every other one back with MADV_DONTNEED so that no 2 MB run is
+ * left free, then writes a 2 MB-aligned range with transparent huge
+ * pages on.  Compaction must move the remaining pages out of the way
+ * to make the huge page: the range reads back as one physically
+ * contiguous run, and the moved pages keep their contents. */
+
+#include <stdint.h>
+#include <string.h>
+#include <syscall.h>
+#include <vmstat.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGE_SIZE 4096
+#define TWO_MB (2 << 20)
+#define FRAG_PAGES 768
+#define HUGE_PAGES (TWO_MB / PAGE_SIZE)
+
+static char frag[FRAG_PAGES * PAGE_SIZE];
+static char big[2 * TWO_MB];
+
+void
+test_main (void)
+{
+	char *huge = (char *) (((uintptr_t) big + TWO_MB - 1) & ~(TWO_MB - 1));
+	char *pa;
+	size_t i;
+
+	/* Read first, so that the writes get single pages. */
+	for (i = 0; i < FRAG_PAGES; i++)
+		if (frag[i * PAGE_SIZE] != 0)
+			fail ("page %zu not zero", i);
+	for (i = 0; i < FRAG_PAGES; i++)
+		memset (frag + i * PAGE_SIZE, 'a' + i % 26, PAGE_SIZE);
+	for (i = 1; i < FRAG_PAGES; i += 2)
+		if (madvise (frag + i * PAGE_SIZE, PAGE_SIZE, MADV_DONTNEED))
+			fail ("madvise MADV_DONTNEED on page %zu failed", i);
+	msg ("fragmented %d pages", FRAG_PAGES);
+
+	memset (huge, 'z', TWO_MB);
+	pa = get_phys_addr (huge);
+	if ((uintptr_t) pa % TWO_MB != 0)
+		fail ("huge range not 2 MB aligned in memory");
+	for (i = 1; i < HUGE_PAGES; i++)
+		if (get_phys_addr (huge + i * PAGE_SIZE) != pa + i * PAGE_SIZE)
+			fail ("huge range not contiguous at page %zu", i);
+	msg ("huge page mapped");
+
+	for (i = 0; i < FRAG_PAGES; i++) {
+		char *page = frag + i * PAGE_SIZE;
+		char want = i % 2 ? 0 : 'a' + i % 26;
+
+		if (page[0] != want || page[PAGE_SIZE - 1] != want)
+			fail ("page %zu lost its contents", i);
+	}
+	for (i = 0; i < TWO_MB; i += PAGE_SIZE)
+		if (huge[i] != 'z')
+			fail ("huge range lost its contents at %zu", i);
+	msg ("contents ok");
+}
@@ -0,0 +1,12 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(compact-huge) begin
+(compact-huge) fragmented 768 pages
+(compact-huge) huge page mapped
+(compact-huge) contents ok
+(compact-huge) end
+EOF
+pass;
@@ -0,0 +1,50 @@
+/* Measures fork latency as the parent's resident memory grows.
+   With copy-on-write the cost per page is a PTE update rather than
+   a page copy, so latency should grow slowly with the footprint.
+   The cycle counts are printed for reference only. */
+
+#include <string.h>
+#include <syscall.h>
+#include <stdio.h>
+#include <stdint.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGE_SIZE 4096
+#define MAX_PAGES 256
+
+static char buf[MAX_PAGES * PAGE_SIZE];
+
+/* Returns the processor's time-stamp counter. */
+static inline uint64_t
+rdtsc (void)
+{
+	uint32_t lo, hi;
+	asm volatile ("rdtsc" : "=a" (lo), "=d" (hi));
+	return ((uint64_t) hi << 32) | lo;
+}
+
+void
+test_main (void)
+{
+	static const int sizes[] = { 1, 16, 64, MAX_PAGES };
+	size_t i;
+
+	for (i = 0; i < sizeof sizes / sizeof *sizes; i++) {
+		char fill = 'a' + i;
+		uint64_t start, cycles;
+		pid_t child;
+
+		memset (buf, fill, sizes[i] * PAGE_SIZE);
+
+		start = rdtsc ();
+		child = fork ("child");
+		if (child == 0)
+			exit (buf[0] == fill ? 0 : 1);
+		cycles = rdtsc () - start;
+
+		CHECK (wait (child) == 0, "child saw %d pages", sizes[i]);
+		msg ("fork with %d pages: %llu cycles", sizes[i],
+				(unsigned long long) cycles);
+	}
+}
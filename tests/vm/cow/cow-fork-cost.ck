@@ -0,0 +1,25 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+
+our ($test);
+my (@output) = read_text_file ("$test.output");
+common_checks ("run", @output);
+
+# Latencies differ from run to run; only their presence is checked.
+s/: \d+ cycles$/: N cycles/ foreach @output;
+
+compare_output ("run", IGNORE_EXIT_CODES => 1, \@output, [<<'EOF']);
+(cow-fork-cost) begin
+(cow-fork-cost) child saw 1 pages
+(cow-fork-cost) fork with 1 pages: N cycles
+(cow-fork-cost) child saw 16 pages
+(cow-fork-cost) fork with 16 pages: N cycles
+(cow-fork-cost) child saw 64 pages
+(cow-fork-cost) fork with 64 pages: N cycles
+(cow-fork-cost) child saw 256 pages
+(cow-fork-cost) fork with 256 pages: N cycles
+(cow-fork-cost) end
+EOF
+pass;
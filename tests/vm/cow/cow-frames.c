@@ -0,0 +1,68 @@
+/* Counts the frames a fork allocates.  Right after fork the child
+   must share every page with the parent; reading changes nothing,
+   and writing copies exactly the pages written.  Once the child is
+   gone, the parent's writes must reuse its own frames instead of
+   copying them. */
+
+#include <string.h>
+#include <syscall.h>
+#include <stdio.h>
+#include <stdint.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGE_SIZE 4096
+#define PAGE_CNT 16
+
+static char buf[PAGE_CNT * PAGE_SIZE] __attribute__ ((aligned (PAGE_SIZE)));
+static void *pa[PAGE_CNT];
+
+/* Returns the number of pages of BUF still in the frames recorded
+   in PA. */
+static int
+count_shared (void)
+{
+	int shared = 0;
+	int i;
+
+	for (i = 0; i < PAGE_CNT; i++)
+		if (get_phys_addr (buf + i * PAGE_SIZE) == pa[i])
+			shared++;
+	return shared;
+}
+
+void
+test_main (void)
+{
+	pid_t child;
+	int sum = 0;
+	int i;
+
+	for (i = 0; i < PAGE_CNT; i++) {
+		buf[i * PAGE_SIZE] = i;
+		pa[i] = get_phys_addr (buf + i * PAGE_SIZE);
+	}
+
+	child = fork ("child");
+	if (child == 0) {
+		msg ("%d of %d pages shared after fork", count_shared (), PAGE_CNT);
+		for (i = 0; i < PAGE_CNT; i++)
+			sum += buf[i * PAGE_SIZE];
+		CHECK (sum == PAGE_CNT * (PAGE_CNT - 1) / 2, "child reads parent's data");
+		msg ("%d of %d pages shared after reading", count_shared (), PAGE_CNT);
+		for (i = 0; i < PAGE_CNT; i += 2)
+			buf[i * PAGE_SIZE] = -1;
+		msg ("%d of %d pages shared after writing half",
+				count_shared (), PAGE_CNT);
+		exit (0);
+	}
+	wait (child);
+
+	for (i = 0; i < PAGE_CNT; i++)
+		sum += buf[i * PAGE_SIZE];
+	CHECK (sum == PAGE_CNT * (PAGE_CNT - 1) / 2, "parent's data unchanged");
+	msg ("%d of %d pages kept by parent", count_shared (), PAGE_CNT);
+	for (i = 0; i < PAGE_CNT; i++)
+		buf[i * PAGE_SIZE] = 0;
+	msg ("%d of %d pages kept after parent writes", count_shared (), PAGE_CNT);
+}
@@ -0,0 +1,16 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(cow-frames) begin
+(cow-frames) 16 of 16 pages shared after fork
+(cow-frames) child reads parent's data
+(cow-frames) 16 of 16 pages shared after reading
+(cow-frames) 8 of 16 pages shared after writing half
+(cow-frames) parent's data unchanged
+(cow-frames) 16 of 16 pages kept by parent
+(cow-frames) 16 of 16 pages kept after parent writes
+(cow-frames) end
+EOF
+pass;
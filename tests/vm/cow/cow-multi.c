@@ -0,0 +1,41 @@
+/* Forks several children in turn.  Each child must start out
+   sharing the parent's frame and get a private copy on its first
+   write, while the parent's data and frame stay untouched. */
+
+#include <string.h>
+#include <syscall.h>
+#include <stdio.h>
+#include <stdint.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+#include "tests/vm/large.inc"
+
+#define CHILD_CNT 4
+
+void
+test_main (void)
+{
+	char *buf = "Lorem ipsum";
+	void *pa_parent;
+	int i;
+
+	pa_parent = get_phys_addr ((void *) large);
+
+	for (i = 0; i < CHILD_CNT; i++) {
+		pid_t child = fork ("child");
+		if (child == 0) {
+			CHECK (get_phys_addr ((void *) large) == pa_parent,
+					"child %d shares the parent's frame", i);
+			large[0] = '0' + i;
+			CHECK (large[0] == '0' + i, "child %d sees its own write", i);
+			CHECK (get_phys_addr ((void *) large) != pa_parent,
+					"child %d got a private frame", i);
+			exit (0);
+		}
+		wait (child);
+	}
+
+	CHECK (memcmp (buf, large, strlen (buf)) == 0, "check data consistency");
+	CHECK (pa_parent == get_phys_addr ((void *) large),
+			"parent kept its frame");
+}
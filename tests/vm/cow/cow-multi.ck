@@ -0,0 +1,23 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(cow-multi) begin
+(cow-multi) child 0 shares the parent's frame
+(cow-multi) child 0 sees its own write
+(cow-multi) child 0 got a private frame
+(cow-multi) child 1 shares the parent's frame
+(cow-multi) child 1 sees its own write
+(cow-multi) child 1 got a private frame
+(cow-multi) child 2 shares the parent's frame
+(cow-multi) child 2 sees its own write
+(cow-multi) child 2 got a private frame
+(cow-multi) child 3 shares the parent's frame
+(cow-multi) child 3 sees its own write
+(cow-multi) child 3 got a private frame
+(cow-multi) check data consistency
+(cow-multi) parent kept its frame
+(cow-multi) end
+EOF
+pass;
@@ -0,0 +1,63 @@
+/* Writes and checks 8 MB of bss with transparent huge pages on,
+ * then gives back single pages inside what are likely huge pages
+ * with MADV_DONTNEED, which must split them: those pages read back
+ * as zeros and the pages around them keep their contents. */
+
+#include <string.h>
+#include <syscall.h>
+#include <vmstat.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGE_SIZE 4096
+#define ONE_MB (1 << 20)
+#define CHUNK_SIZE (8 * ONE_MB)
+#define PAGE_COUNT (CHUNK_SIZE / PAGE_SIZE)
+
+/* Pages given back, one in every 512. */
+#define DROP_STRIDE 512
+#define DROP_OFFSET 300
+
+static char big_chunks[CHUNK_SIZE];
+
+/* Returns true if page I was given back. */
+static bool
+dropped (size_t i)
+{
+	return i % DROP_STRIDE == DROP_OFFSET;
+}
+
+void
+test_main (void)
+{
+	size_t i;
+
+	msg ("write %d pages", PAGE_COUNT);
+	for (i = 0; i < PAGE_COUNT; i++) {
+		char fill = 'a' + i % 26;
+
+		memset (big_chunks + i * PAGE_SIZE, fill, PAGE_SIZE);
+	}
+
+	for (i = 0; i < PAGE_COUNT; i++) {
+		char *page = big_chunks + i * PAGE_SIZE;
+		char want = 'a' + i % 26;
+
+		if (page[0] != want || page[PAGE_SIZE - 1] != want)
+			fail ("page %zu lost its contents", i);
+	}
+	msg ("contents ok");
+
+	for (i = DROP_OFFSET; i < PAGE_COUNT; i += DROP_STRIDE)
+		if (madvise (big_chunks + i * PAGE_SIZE, PAGE_SIZE, MADV_DONTNEED))
+			fail ("madvise MADV_DONTNEED on page %zu failed", i);
+
+	for (i = 0; i < PAGE_COUNT; i++) {
+		char *page = big_chunks + i * PAGE_SIZE;
+		char want = dropped (i) ? 0 : 'a' + i % 26;
+
+		if (page[0] != want || page[PAGE_SIZE - 1] != want)
+			fail ("page %zu has wrong contents after split", i);
+	}
+	msg ("contents ok after split");
+}
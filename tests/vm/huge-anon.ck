@@ -0,0 +1,12 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(huge-anon) begin
+(huge-anon) write 2048 pages
+(huge-anon) contents ok
+(huge-anon) contents ok after split
+(huge-anon) end
+EOF
+pass;
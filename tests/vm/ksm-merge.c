@@ -0,0 +1,73 @@
+/* Fills 8 MB of bss with a few distinct pages repeated over and
+ * over, and keeps reading them while ksmd (-ksm) merges the copies.
+ * Then writes to every page, which must break each page away from
+ * the frame it shares, and checks that every page holds its own
+ * contents afterward. */
+
+#include <string.h>
+#include <stdint.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGE_SHIFT 12
+#define PAGE_SIZE (1 << PAGE_SHIFT)
+#define ONE_MB (1 << 20) // 1MB
+#define CHUNK_SIZE (8*ONE_MB)
+#define PAGE_COUNT (CHUNK_SIZE / PAGE_SIZE)
+
+/* Number of passes reading all of the pages. */
+#define READ_PASSES 200
+
+static char big_chunks[CHUNK_SIZE];
+
+/* Returns true if every byte of PAGE is C. */
+static bool
+page_is (const char *page, char c)
+{
+	size_t i;
+
+	for (i = 0; i < PAGE_SIZE; i++)
+		if (page[i] != c)
+			return false;
+	return true;
+}
+
+void
+test_main (void)
+{
+	size_t i;
+	int pass;
+
+	msg ("fill pages");
+	for (i = 0; i < PAGE_COUNT; i++) {
+		char fill = 'a' + i % 4;
+
+		memset (big_chunks + i * PAGE_SIZE, fill, PAGE_SIZE);
+	}
+
+	msg ("read pages");
+	for (pass = 0; pass < READ_PASSES; pass++)
+		for (i = 0; i < PAGE_COUNT; i++) {
+			char fill = 'a' + i % 4;
+
+			if (!page_is (big_chunks + i * PAGE_SIZE, fill))
+				fail ("page %zu changed while being merged", i);
+		}
+
+	msg ("write pages");
+	for (i = 0; i < PAGE_COUNT; i++)
+		big_chunks[i * PAGE_SIZE + i % PAGE_SIZE] = 'z';
+
+	for (i = 0; i < PAGE_COUNT; i++) {
+		char *page = big_chunks + i * PAGE_SIZE;
+		char fill = 'a' + i % 4;
+
+		if (page[i % PAGE_SIZE] != 'z')
+			fail ("write to page %zu was lost", i);
+		page[i % PAGE_SIZE] = fill;
+		if (!page_is (page, fill))
+			fail ("page %zu holds another page's write", i);
+	}
+	msg ("check done");
+}
@@ -0,0 +1,13 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(ksm-merge) begin
+(ksm-merge) fill pages
+(ksm-merge) read pages
+(ksm-merge) write pages
+(ksm-merge) check done
+(ksm-merge) end
+EOF
+pass;
@@ -0,0 +1,63 @@
+/* Reads 64 MB of untouched bss, far more than fits in memory and
+ * swap together, then writes to some of it.  Pintos runs with 10 MB
+ * of memory and the default 4 MB swap disk, so this only passes if
+ * reading a page that was never written does not use up a frame
+ * or swap space of its own. */
+
+#include <string.h>
+#include <stdint.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGE_SHIFT 12
+#define PAGE_SIZE (1 << PAGE_SHIFT)
+#define ONE_MB (1 << 20) // 1MB
+#define CHUNK_SIZE (64*ONE_MB)
+#define PAGE_COUNT (CHUNK_SIZE / PAGE_SIZE)
+
+static char big_chunks[CHUNK_SIZE];
+
+/* Returns true if every byte of PAGE is zero. */
+static bool
+page_is_zero (const char *page)
+{
+	size_t i;
+
+	for (i = 0; i < PAGE_SIZE; i++)
+		if (page[i] != 0)
+			return false;
+	return true;
+}
+
+void
+test_main (void)
+{
+	size_t i;
+
+	for (i = 0; i < PAGE_COUNT; i++) {
+		if (!(i % 4096))
+			msg ("read page %zu", i);
+		if (!page_is_zero (big_chunks + i * PAGE_SIZE))
+			fail ("page %zu is not zero", i);
+	}
+
+	msg ("write every 1024th page");
+	for (i = 0; i < PAGE_COUNT; i += 1024) {
+		char fill = 'a' + i / 1024 % 26;
+
+		memset (big_chunks + i * PAGE_SIZE, fill, PAGE_SIZE);
+	}
+
+	for (i = 0; i < PAGE_COUNT; i++) {
+		char *page = big_chunks + i * PAGE_SIZE;
+		char fill = 'a' + i / 1024 % 26;
+
+		if (i % 1024 == 0) {
+			if (page[0] != fill || page[PAGE_SIZE - 1] != fill)
+				fail ("page %zu lost its contents", i);
+		} else if (!page_is_zero (page))
+			fail ("page %zu is not zero after writes", i);
+	}
+	msg ("check done");
+}
@@ -0,0 +1,15 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(lazy-zero) begin
+(lazy-zero) read page 0
+(lazy-zero) read page 4096
+(lazy-zero) read page 8192
+(lazy-zero) read page 12288
+(lazy-zero) write every 1024th page
+(lazy-zero) check done
+(lazy-zero) end
+EOF
+pass;
@@ -0,0 +1,57 @@
+/* Checks madvise() on anonymous memory: advice is accepted on
+ * mapped and unmapped ranges, bad arguments are refused,
+ * MADV_WILLNEED keeps the contents, and MADV_DONTNEED makes the
+ * pages read back as zeros while leaving the pages around them
+ * alone. */
+
+#include <string.h>
+#include <syscall.h>
+#include <vmstat.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGE_SIZE 4096
+#define PAGE_COUNT 64
+
+static char buf[PAGE_COUNT * PAGE_SIZE] __attribute__ ((aligned (PAGE_SIZE)));
+
+void
+test_main (void)
+{
+	size_t i;
+
+	for (i = 0; i < PAGE_COUNT; i++)
+		memset (buf + i * PAGE_SIZE, 'a' + i % 26, PAGE_SIZE);
+
+	CHECK (madvise (buf, sizeof buf, MADV_SEQUENTIAL) == 0,
+			"madvise MADV_SEQUENTIAL");
+	CHECK (madvise (buf, sizeof buf, MADV_RANDOM) == 0, "madvise MADV_RANDOM");
+	CHECK (madvise (buf, sizeof buf, MADV_NORMAL) == 0, "madvise MADV_NORMAL");
+	CHECK (madvise (buf + 1, PAGE_SIZE, MADV_NORMAL) == -1,
+			"madvise misaligned address");
+	CHECK (madvise (buf, PAGE_SIZE, 12345) == -1, "madvise bad advice");
+	CHECK (madvise ((void *) 0x8004000000, PAGE_SIZE, MADV_NORMAL) == -1,
+			"madvise kernel address");
+
+	CHECK (madvise (buf, sizeof buf, MADV_WILLNEED) == 0,
+			"madvise MADV_WILLNEED");
+	for (i = 0; i < PAGE_COUNT; i++) {
+		char want = 'a' + i % 26;
+
+		if (buf[i * PAGE_SIZE] != want)
+			fail ("page %zu changed after MADV_WILLNEED", i);
+	}
+
+	CHECK (madvise (buf + 8 * PAGE_SIZE, 8 * PAGE_SIZE, MADV_DONTNEED) == 0,
+			"madvise MADV_DONTNEED");
+	for (i = 0; i < PAGE_COUNT; i++) {
+		char want = i >= 8 && i < 16 ? 0 : 'a' + i % 26;
+		size_t j;
+
+		for (j = 0; j < PAGE_SIZE; j++)
+			if (buf[i * PAGE_SIZE + j] != want)
+				fail ("byte %zu of page %zu is %d, not %d", j, i,
+						buf[i * PAGE_SIZE + j], want);
+	}
+	msg ("check done");
+}
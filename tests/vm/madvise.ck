@@ -0,0 +1,18 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(madvise) begin
+(madvise) madvise MADV_SEQUENTIAL
+(madvise) madvise MADV_RANDOM
+(madvise) madvise MADV_NORMAL
+(madvise) madvise misaligned address
+(madvise) madvise bad advice
+(madvise) madvise kernel address
+(madvise) madvise MADV_WILLNEED
+(madvise) madvise MADV_DONTNEED
+(madvise) check done
+(madvise) end
+EOF
+pass;
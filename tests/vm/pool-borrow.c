@@ -0,0 +1,51 @@
+/* Writes three times as many pages as the 256-page user pool holds,
+ * with the user pool allowed to borrow from the kernel pool.  The
+ * pages must come from the kernel pool rather than from eviction,
+ * keep their contents, and go back to the kernel pool once they are
+ * dropped with MADV_DONTNEED. */
+
+#include <string.h>
+#include <syscall.h>
+#include <vmstat.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGE_SIZE 4096
+#define PAGE_COUNT 768
+
+static char buf[PAGE_COUNT * PAGE_SIZE] __attribute__ ((aligned (PAGE_SIZE)));
+static struct vmstat before, during, after;
+
+void
+test_main (void)
+{
+	size_t i;
+
+	CHECK (vmstat (&during) == 0, "vmstat");
+	CHECK (vmstat (&after) == 0, "vmstat");
+	CHECK (vmstat (&before) == 0, "vmstat");
+
+	for (i = 0; i < PAGE_COUNT; i++)
+		memset (buf + i * PAGE_SIZE, 'a' + i % 26, PAGE_SIZE);
+	for (i = 0; i < PAGE_COUNT; i++) {
+		char c = 'a' + i % 26;
+
+		if (buf[i * PAGE_SIZE] != c || buf[i * PAGE_SIZE + PAGE_SIZE - 1] != c)
+			fail ("page %zu has wrong contents", i);
+	}
+	msg ("wrote %d pages", PAGE_COUNT);
+
+	CHECK (vmstat (&during) == 0, "vmstat");
+	if (during.evictions != before.evictions)
+		fail ("%lld frames evicted", during.evictions - before.evictions);
+	if (during.pool_borrowed[1] < PAGE_COUNT / 2)
+		fail ("user pool borrowed only %lld pages", during.pool_borrowed[1]);
+	msg ("borrowed without evicting");
+
+	CHECK (madvise (buf, sizeof buf, MADV_DONTNEED) == 0,
+			"madvise MADV_DONTNEED");
+	CHECK (vmstat (&after) == 0, "vmstat");
+	if (after.pool_borrowed[1] >= during.pool_borrowed[1])
+		fail ("user pool still borrows %lld pages", after.pool_borrowed[1]);
+	msg ("pages returned");
+}
@@ -0,0 +1,18 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(pool-borrow) begin
+(pool-borrow) vmstat
+(pool-borrow) vmstat
+(pool-borrow) vmstat
+(pool-borrow) wrote 768 pages
+(pool-borrow) vmstat
+(pool-borrow) borrowed without evicting
+(pool-borrow) madvise MADV_DONTNEED
+(pool-borrow) vmstat
+(pool-borrow) pages returned
+(pool-borrow) end
+EOF
+pass;
@@ -0,0 +1,54 @@
+/* Recurses 128 pages deep, each call touching a page-sized frame.
+ * Stack growth maps several pages per fault, so it must take far
+ * fewer growth faults than pages, and every frame keeps its
+ * contents. */
+
+#include <string.h>
+#include <syscall.h>
+#include <vmstat.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGE_SIZE 4096
+#define DEPTH 128
+
+static struct vmstat before, after;
+
+/* Fills a page of stack with DEPTH's value, recurses, and checks
+ * the page is still intact on the way back.  Returns the sum of the
+ * depths below. */
+static int
+recurse (int depth)
+{
+	char frame[PAGE_SIZE];
+	int sum = depth;
+	size_t i;
+
+	memset (frame, depth, sizeof frame);
+	if (depth > 0)
+		sum += recurse (depth - 1);
+	for (i = 0; i < sizeof frame; i++)
+		if (frame[i] != (char) depth)
+			fail ("frame at depth %d changed", depth);
+	return sum;
+}
+
+void
+test_main (void)
+{
+	long long faults;
+	int sum;
+
+	CHECK (vmstat (&after) == 0, "vmstat");
+	CHECK (vmstat (&before) == 0, "vmstat");
+	sum = recurse (DEPTH);
+	CHECK (vmstat (&after) == 0, "vmstat");
+
+	if (sum != DEPTH * (DEPTH + 1) / 2)
+		fail ("sum of depths is %d", sum);
+	faults = after.faults[VMSTAT_FAULT_STACK]
+		- before.faults[VMSTAT_FAULT_STACK];
+	if (faults > DEPTH / 4)
+		fail ("%lld stack growth faults for %d pages", faults, DEPTH);
+	msg ("stack grew with few faults");
+}
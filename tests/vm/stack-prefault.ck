@@ -0,0 +1,13 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(stack-prefault) begin
+(stack-prefault) vmstat
+(stack-prefault) vmstat
+(stack-prefault) vmstat
+(stack-prefault) stack grew with few faults
+(stack-prefault) end
+EOF
+pass;
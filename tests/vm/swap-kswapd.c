@@ -0,0 +1,60 @@
+/* Checks that anonymous pages survive eviction by kswapd.  Pintos
+ * runs with 10 MB of memory and kswapd keeps 64 to 256 user frames
+ * free (-kswapd-low=64 -kswapd-high=256), so most pages are written
+ * to swap in the background rather than by the faulting thread.
+ * Every page is filled with its own pattern, then checked twice. */
+
+#include <string.h>
+#include <stdint.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGE_SHIFT 12
+#define PAGE_SIZE (1 << PAGE_SHIFT)
+#define ONE_MB (1 << 20) // 1MB
+#define CHUNK_SIZE (16*ONE_MB)
+#define PAGE_COUNT (CHUNK_SIZE / PAGE_SIZE)
+
+static char big_chunks[CHUNK_SIZE];
+
+/* Returns the byte at offset J of page I. */
+static char
+pattern (size_t i, size_t j)
+{
+	return (i * 7 + j / 512) & 0xff;
+}
+
+/* Checks every page, failing on the first byte that differs. */
+static void
+check (int pass)
+{
+	size_t i, j;
+
+	for (i = 0; i < PAGE_COUNT; i++) {
+		char *page = big_chunks + i * PAGE_SIZE;
+
+		for (j = 0; j < PAGE_SIZE; j += 512)
+			if (page[j] != pattern (i, j))
+				fail ("pass %d: page %zu is inconsistent", pass, i);
+		if (!(i % 1024))
+			msg ("pass %d: check consistency in page %zu", pass, i);
+	}
+}
+
+void
+test_main (void)
+{
+	size_t i, j;
+
+	for (i = 0; i < PAGE_COUNT; i++) {
+		char *page = big_chunks + i * PAGE_SIZE;
+
+		if (!(i % 1024))
+			msg ("fill page %zu", i);
+		for (j = 0; j < PAGE_SIZE; j += 512)
+			page[j] = pattern (i, j);
+	}
+	check (1);
+	check (2);
+}
@@ -0,0 +1,21 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(swap-kswapd) begin
+(swap-kswapd) fill page 0
+(swap-kswapd) fill page 1024
+(swap-kswapd) fill page 2048
+(swap-kswapd) fill page 3072
+(swap-kswapd) pass 1: check consistency in page 0
+(swap-kswapd) pass 1: check consistency in page 1024
+(swap-kswapd) pass 1: check consistency in page 2048
+(swap-kswapd) pass 1: check consistency in page 3072
+(swap-kswapd) pass 2: check consistency in page 0
+(swap-kswapd) pass 2: check consistency in page 1024
+(swap-kswapd) pass 2: check consistency in page 2048
+(swap-kswapd) pass 2: check consistency in page 3072
+(swap-kswapd) end
+EOF
+pass;
@@ -0,0 +1,73 @@
+/* Checks that anonymous pages survive a trip through the
+ * compressed swap pool.  Pintos runs with 10 MB of memory and a
+ * 1 MB pool (-zswap=256), so most pages pass through the pool and
+ * many spill from it to the swap disk.
+ * Every fourth page is filled with one byte, two in four hold text
+ * that compresses well, and the rest hold bytes that do not
+ * compress at all. */
+
+#include <string.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGE_SHIFT 12
+#define PAGE_SIZE (1 << PAGE_SHIFT)
+#define ONE_MB (1 << 20) // 1MB
+#define CHUNK_SIZE (16*ONE_MB)
+#define PAGE_COUNT (CHUNK_SIZE / PAGE_SIZE)
+
+static char big_chunks[CHUNK_SIZE];
+
+/* Stores in PAGE, or compares PAGE against, the contents for page
+ * number I.  Returns false if CHECK is true and they differ. */
+static bool
+fill (size_t i, char *page, bool check)
+{
+	char line[64];
+	uint32_t x = i * 2654435761u + 1;
+	size_t j, len;
+	char c;
+
+	if (i % 4 != 3)
+		len = snprintf (line, sizeof line,
+				"page %05zu: the quick brown fox jumps\n", i);
+	for (j = 0; j < PAGE_SIZE; j++) {
+		if (i % 4 == 0)
+			c = i;
+		else if (i % 4 == 3) {
+			x ^= x << 13;
+			x ^= x >> 17;
+			x ^= x << 5;
+			c = x;
+		} else
+			c = line[j % len];
+
+		if (!check)
+			page[j] = c;
+		else if (page[j] != c)
+			return false;
+	}
+	return true;
+}
+
+void
+test_main (void)
+{
+	size_t i;
+
+	for (i = 0; i < PAGE_COUNT; i++) {
+		if (!(i % 1024))
+			msg ("fill page %zu", i);
+		fill (i, big_chunks + i * PAGE_SIZE, false);
+	}
+
+	for (i = 0; i < PAGE_COUNT; i++) {
+		if (!fill (i, big_chunks + i * PAGE_SIZE, true))
+			fail ("data is inconsistent in page %zu", i);
+		if (!(i % 1024))
+			msg ("check consistency in page %zu", i);
+	}
+}
@@ -0,0 +1,17 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(swap-zswap) begin
+(swap-zswap) fill page 0
+(swap-zswap) fill page 1024
+(swap-zswap) fill page 2048
+(swap-zswap) fill page 3072
+(swap-zswap) check consistency in page 0
+(swap-zswap) check consistency in page 1024
+(swap-zswap) check consistency in page 2048
+(swap-zswap) check consistency in page 3072
+(swap-zswap) end
+EOF
+pass;
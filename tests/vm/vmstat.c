@@ -0,0 +1,71 @@
+/* Checks vmstat(): touching fresh pages shows up as first-touch
+ * faults, every fault handled lands in the latency histogram, the
+ * frame table grows, and a buffer outside user memory is refused. */
+
+#include <string.h>
+#include <syscall.h>
+#include <vmstat.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGE_SIZE 4096
+#define PAGE_COUNT 32
+
+static char buf[PAGE_COUNT * PAGE_SIZE] __attribute__ ((aligned (PAGE_SIZE)));
+static struct vmstat before, after;
+
+/* Returns the faults ST counts, summed over all kinds. */
+static long long
+fault_sum (const struct vmstat *st)
+{
+	long long sum = 0;
+	int i;
+
+	for (i = 0; i < VMSTAT_FAULT_CNT; i++)
+		sum += st->faults[i];
+	return sum;
+}
+
+/* Returns the faults in ST's latency histogram. */
+static long long
+latency_sum (const struct vmstat *st)
+{
+	long long sum = 0;
+	int i;
+
+	for (i = 0; i < VMSTAT_HIST_CNT; i++)
+		sum += st->latency[i];
+	return sum;
+}
+
+void
+test_main (void)
+{
+	size_t i;
+
+	/* Fault the result buffers in first, so that they do not count. */
+	CHECK (vmstat (&after) == 0, "vmstat");
+	CHECK (vmstat (&before) == 0, "vmstat");
+
+	for (i = 0; i < PAGE_COUNT; i++)
+		buf[i * PAGE_SIZE] = 'x';
+	CHECK (vmstat (&after) == 0, "vmstat after writing %d pages", PAGE_COUNT);
+
+	if (after.faults[VMSTAT_FAULT_UNINIT] - before.faults[VMSTAT_FAULT_UNINIT]
+			< PAGE_COUNT)
+		fail ("%lld first-touch faults, expected at least %d",
+				after.faults[VMSTAT_FAULT_UNINIT]
+				- before.faults[VMSTAT_FAULT_UNINIT], PAGE_COUNT);
+	if (latency_sum (&after) != fault_sum (&after))
+		fail ("latency histogram holds %lld faults, not %lld",
+				latency_sum (&after), fault_sum (&after));
+	if (after.frames < before.frames + PAGE_COUNT / 2
+			|| after.frames_peak < after.frames)
+		fail ("frame table went from %lld to %lld frames (peak %lld)",
+				before.frames, after.frames, after.frames_peak);
+	msg ("counts ok");
+
+	CHECK (vmstat (NULL) == -1, "vmstat (NULL)");
+	CHECK (vmstat ((struct vmstat *) 0x8004000000) == -1,
+			"vmstat (kernel address)");
+}
@@ -0,0 +1,15 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(vmstat) begin
+(vmstat) vmstat
+(vmstat) vmstat
+(vmstat) vmstat after writing 32 pages
+(vmstat) counts ok
+(vmstat) vmstat (NULL)
+(vmstat) vmstat (kernel address)
+(vmstat) end
+EOF
+pass;
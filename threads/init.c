@@ -31,6 +31,9 @@
 #include "tests/threads/tests.h"
 #ifdef VM
 #include "vm/vm.h"
+#include "vm/ksm.h"
+#include "vm/zswap.h"
+#include "vm/compact.h"
 #endif
 #ifdef FILESYS
 #include "devices/disk.h"
@@ -140,23 +143,76 @@ bss_init (void) {
 	memset (&_start_bss, 0, &_end_bss - &_start_bss);
 }
 
+/* Returns true if the CPU supports 1 GB pages.  See [IA32-v2a]
+ * "CPUID", leaf 80000001h, EDX bit 26. */
+static bool
+has_gb_pages (void) {
+	uint32_t eax, ebx, ecx, edx;
+
+	asm volatile ("cpuid"
+			: "=a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx)
+			: "a" (0x80000000));
+	if (eax < 0x80000001)
+		return false;
+	asm volatile ("cpuid"
+			: "=a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx)
+			: "a" (0x80000001));
+	return (edx >> 26) & 1;
+}
+
+/* Returns the size of the page that maps physical address PA in the
+ * kernel virtual mapping: the largest of 1 GB (if GB_PAGES), 2 MB
+ * and 4 kB that PA is aligned to, that ends by MEM_END and that
+ * does not overlap the kernel text in [TEXT_LO, TEXT_HI), which is
+ * mapped read-only page by page. */
+static uint64_t
+direct_map_size (uint64_t pa, uint64_t mem_end, bool gb_pages,
+		uint64_t text_lo, uint64_t text_hi) {
+	uint64_t size;
+
+	for (size = gb_pages ? PGSIZE_1G : PGSIZE_2M; size > PGSIZE;
+			size = size == PGSIZE_1G ? PGSIZE_2M : PGSIZE)
+		if (pa % size == 0 && pa + size <= mem_end
+				&& (pa + size <= text_lo || pa >= text_hi))
+			break;
+	return size;
+}
+
 /* Populates the page table with the kernel virtual mapping,
  * and then sets up the CPU to use the new page directory.
- * Points base_pml4 to the pml4 it creates. */
+ * Points base_pml4 to the pml4 it creates.
+ *
+ * Physical memory is mapped with the largest pages that fit, so
+ * that the kernel's accesses to it take few TLB entries and little
+ * memory goes to page tables.  Only around the kernel text, which
+ * must be read-only, and at the end of memory are 4 kB pages
+ * used. */
 static void
 paging_init (uint64_t mem_end) {
 	uint64_t *pml4, *pte;
+	uint64_t size, text_lo, text_hi;
+	bool gb_pages = has_gb_pages ();
 	int perm;
 	pml4 = base_pml4 = palloc_get_page (PAL_ASSERT | PAL_ZERO);
 
 	extern char start, _end_kernel_text;
+	text_lo = vtop (&start);
+	text_hi = vtop (&_end_kernel_text);
+
 	// Maps physical address [0 ~ mem_end] to
 	//   [LOADER_KERN_BASE ~ LOADER_KERN_BASE + mem_end].
-	for (uint64_t pa = 0; pa < mem_end; pa += PGSIZE) {
+	for (uint64_t pa = 0; pa < mem_end; pa += size) {
 		uint64_t va = (uint64_t) ptov(pa);
 
+		size = direct_map_size (pa, mem_end, gb_pages, text_lo, text_hi);
+		if (size > PGSIZE) {
+			if (!pml4_set_large_page (pml4, va, pa, size, PTE_W))
+				PANIC ("out of memory for the kernel page tables");
+			continue;
+		}
+
 		perm = PTE_P | PTE_W;
-		if ((uint64_t) &start <= va && va < (uint64_t) &_end_kernel_text)
+		if (text_lo <= pa && pa < text_hi)
 			perm &= ~PTE_W;
 
 		if ((pte = pml4e_walk (pml4, va, 1)) != NULL)
@@ -165,6 +221,7 @@ paging_init (uint64_t mem_end) {
 
 	// reload cr3
 	pml4_activate(0);
+	pml4_pcid_init ();
 }
 
 /* Breaks the kernel command line into words and returns them as
@@ -224,8 +281,30 @@ parse_options (char **argv) {
 #ifdef USERPROG
 		else if (!strcmp (name, "-ul"))
 			user_page_limit = atoi (value);
+		else if (!strcmp (name, "-pool-borrow"))
+			palloc_borrow_max = atoi (value);
+		else if (!strcmp (name, "-pool-reserve"))
+			palloc_reserve = atoi (value);
 		else if (!strcmp (name, "-threads-tests"))
 			thread_tests = true;
+#endif
+#ifdef VM
+		else if (!strcmp (name, "-zswap"))
+			zswap_pool_pages = atoi (value);
+		else if (!strcmp (name, "-ksm"))
+			ksm_scan_pages = atoi (value);
+		else if (!strcmp (name, "-ksm-sleep"))
+			ksm_sleep_ms = atoi (value);
+		else if (!strcmp (name, "-kswapd-low"))
+			kswapd_low = atoi (value);
+		else if (!strcmp (name, "-kswapd-high"))
+			kswapd_high = atoi (value);
+		else if (!strcmp (name, "-thp"))
+			thp_enabled = true;
+		else if (!strcmp (name, "-kcompactd"))
+			compact_sleep_ms = atoi (value);
+		else if (!strcmp (name, "-stack-limit"))
+			stack_limit = atoi (value);
 #endif
 		else
 			PANIC ("unknown option `%s' (use -h for help)", name);
@@ -328,6 +407,18 @@ usage (void) {
 			"  -mlfqs             Use multi-level feedback queue scheduler.\n"
 #ifdef USERPROG
 			"  -ul=COUNT          Limit user memory to COUNT pages.\n"
+			"  -pool-borrow=COUNT Let each pool borrow up to COUNT pages of the other...\n"
+			"  -pool-reserve=COUNT ...leaving it COUNT pages free (default 256).\n"
+#endif
+#ifdef VM
+			"  -zswap=COUNT       Compress swapped pages into COUNT kernel pages.\n"
+			"  -ksm=COUNT         Merge identical pages, scanning COUNT per wakeup.\n"
+			"  -ksm-sleep=MS      Sleep MS milliseconds between ksm scans.\n"
+			"  -kswapd-low=COUNT  Evict in the background below COUNT free frames...\n"
+			"  -kswapd-high=COUNT ...until COUNT frames are free (default 2 * low).\n"
+			"  -thp               Map large anonymous regions with 2 MB pages.\n"
+			"  -kcompactd=MS      Compact user memory every MS milliseconds.\n"
+			"  -stack-limit=COUNT Let user stacks grow to COUNT pages (default 256).\n"
 #endif
 			);
 	power_off ();
@@ -354,6 +445,7 @@ static void
 print_stats (void) {
 	timer_print_stats ();
 	thread_print_stats ();
+	palloc_print_stats ();
 #ifdef FILESYS
 	disk_print_stats ();
 #endif
@@ -362,4 +454,7 @@ print_stats (void) {
 #ifdef USERPROG
 	exception_print_stats ();
 #endif
+#ifdef VM
+	vm_print_stats ();
+#endif
 }
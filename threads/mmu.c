@@ -1,13 +1,87 @@
+#include <debug.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <string.h>
 #include "threads/init.h"
+#include "threads/interrupt.h"
 #include "threads/pte.h"
 #include "threads/palloc.h"
 #include "threads/thread.h"
 #include "threads/mmu.h"
 #include "intrinsic.h"
 
+/* Process-context identifiers (PCIDs).  Once CR4.PCIDE is set, the
+ * TLB tags its entries with the PCID in the low 12 bits of CR3, so
+ * they can outlive a switch to another address space: CR3 is loaded
+ * with CR3_NOFLUSH set and each space finds its own entries still
+ * there when it comes back.
+ *
+ * PCID 0 belongs to base_pml4.  The others go to user page tables as
+ * they are activated, recycling the one activated least recently
+ * when all are in use.  A PCID is flushed on its first activation
+ * for a page table, and on its next activation after a change to its
+ * page table made while another one was active, when invlpg could
+ * not reach its entries. */
+#define PCID_CNT 64
+#define CR3_NOFLUSH (1UL << 63)
+#define CR4_PCIDE (1UL << 17)
+
+struct pcid {
+	uint64_t *pml4;             /* Page table using it, or NULL. */
+	uint64_t last_use;          /* PCID_CLOCK at its last activation. */
+	bool stale;                 /* Must be flushed on activation. */
+};
+
+static struct pcid pcids[PCID_CNT];
+static bool pcid_enabled;
+static uint64_t pcid_clock;
+
+static struct pcid *pcid_find (uint64_t *pml4);
+static void tlb_flush_page (uint64_t *pml4, uint64_t va);
+
+/* Shifts of the indexes into the four levels of page tables, from
+ * the pml4 down to the page table. */
+static const uint64_t walk_shift[] = {
+	PML4SHIFT, PDPESHIFT, PDXSHIFT, PTXSHIFT,
+};
+
+/* Replaces *ENTRY, a PDPE or PDE with PTE_PS set that maps the
+ * large page of SIZE bytes around VA, by TABLE, a page filled in
+ * with 512 entries that map the same memory in pages of SIZE / 512
+ * bytes with the same flags: 2 MB pages for a 1 GB page, 4 kB pages
+ * for a 2 MB one. */
+static void
+split_large_page (uint64_t *entry, uint64_t size, uint64_t va,
+		uint64_t *table) {
+	uint64_t step = size / 512;
+	uint64_t flags = *entry & PTE_FLAGS;
+	uint64_t pa = PTE_ADDR (*entry) & ~(size - 1);
+
+	if (step == PGSIZE)
+		flags &= ~(uint64_t) PTE_PS;
+	for (unsigned i = 0; i < 512; i++)
+		table[i] = (pa + i * step) | flags;
+	*entry = vtop (table) | PTE_U | PTE_W | PTE_P;
+
+	/* The translations are unchanged, but the TLB must not mix the
+	 * old large entry with the new ones.  One invlpg anywhere in a
+	 * large page drops all of it. */
+	invlpg (va & ~(size - 1));
+}
+
+/* Splits the large page *ENTRY of SIZE bytes around VA with a newly
+ * allocated table, as split_large_page() does.  Returns false if
+ * memory for the table cannot be had. */
+static bool
+split_large_page_alloc (uint64_t *entry, uint64_t size, uint64_t va) {
+	uint64_t *table = palloc_get_page (0);
+
+	if (table == NULL)
+		return false;
+	split_large_page (entry, size, va, table);
+	return true;
+}
+
 static uint64_t *
 pgdir_walk (uint64_t *pdp, const uint64_t va, int create) {
 	int idx = PDX (va);
@@ -23,6 +97,13 @@ pgdir_walk (uint64_t *pdp, const uint64_t va, int create) {
 			} else
 				return NULL;
 		}
+		/* A 2 MB page is its own entry, unless a PTE is wanted. */
+		if (pdp[idx] & PTE_PS) {
+			if (!create)
+				return &pdp[idx];
+			if (!split_large_page_alloc (&pdp[idx], PGSIZE_2M, va))
+				return NULL;
+		}
 		return (uint64_t *) ptov (PTE_ADDR (pdp[idx]) + 8 * PTX (va));
 	}
 	return NULL;
@@ -46,6 +127,13 @@ pdpe_walk (uint64_t *pdpe, const uint64_t va, int create) {
 			} else
 				return NULL;
 		}
+		/* Likewise for a 1 GB page. */
+		if (pdpe[idx] & PTE_PS) {
+			if (!create)
+				return &pdpe[idx];
+			if (!split_large_page_alloc (&pdpe[idx], PGSIZE_1G, va))
+				return NULL;
+		}
 		pte = pgdir_walk (ptov (PTE_ADDR (pdpe[idx])), va, create);
 	}
 	if (pte == NULL && allocated) {
@@ -60,7 +148,10 @@ pdpe_walk (uint64_t *pdpe, const uint64_t va, int create) {
  * If PML4E does not have a page table for VADDR, behavior depends
  * on CREATE.  If CREATE is true, then a new page table is
  * created and a pointer into it is returned.  Otherwise, a null
- * pointer is returned. */
+ * pointer is returned.
+ * If VADDR lies in a large page, the PDE or PDPE mapping it is
+ * returned when CREATE is false; otherwise the large page is first
+ * split down to 4 kB pages. */
 uint64_t *
 pml4e_walk (uint64_t *pml4e, const uint64_t va, int create) {
 	uint64_t *pte = NULL;
@@ -88,6 +179,75 @@ pml4e_walk (uint64_t *pml4e, const uint64_t va, int create) {
 	return pte;
 }
 
+/* Returns the entry that maps VA in PML4, be it a PTE or the PDE or
+ * PDPE of a large page, and stores the size of the page it maps in
+ * *SIZE.  Returns a null pointer if VA is not mapped. */
+static uint64_t *
+pml4_lookup (uint64_t *pml4, uint64_t va, uint64_t *size) {
+	uint64_t *table = pml4;
+
+	for (int level = 0; level < 4; level++) {
+		uint64_t *e = &table[(va >> walk_shift[level]) & 0x1FF];
+
+		if (!(*e & PTE_P))
+			return NULL;
+		if (level == 3 || (level > 0 && (*e & PTE_PS))) {
+			*size = 1UL << walk_shift[level];
+			return e;
+		}
+		table = ptov (PTE_ADDR (*e));
+	}
+	NOT_REACHED ();
+}
+
+/* Maps the large page of SIZE bytes, 2 MB or 1 GB, at physical
+ * address PA at virtual address VA in PML4, with one PDE or PDPE
+ * carrying the PTE_* FLAGS.  VA and PA must be aligned to SIZE.
+ * Used to build the kernel's direct map and for transparent huge
+ * user pages.  Returns false if memory for a page table cannot be
+ * had, or if the entry is in use, even by a page table with no
+ * pages mapped in it. */
+bool
+pml4_set_large_page (uint64_t *pml4, uint64_t va, uint64_t pa,
+		uint64_t size, uint64_t flags) {
+	int depth = size == PGSIZE_1G ? 1 : 2;
+	uint64_t *table = pml4;
+
+	ASSERT (size == PGSIZE_2M || size == PGSIZE_1G);
+	ASSERT (va % size == 0 && pa % size == 0);
+
+	for (int level = 0; level < depth; level++) {
+		uint64_t *e = &table[(va >> walk_shift[level]) & 0x1FF];
+
+		if (!(*e & PTE_P)) {
+			uint64_t *new_page = palloc_get_page (PAL_ZERO);
+			if (new_page == NULL)
+				return false;
+			*e = vtop (new_page) | PTE_U | PTE_W | PTE_P;
+		}
+		ASSERT (!(*e & PTE_PS));
+		table = ptov (PTE_ADDR (*e));
+	}
+	table += (va >> walk_shift[depth]) & 0x1FF;
+	if (*table & PTE_P)
+		return false;
+	*table = pa | flags | PTE_PS | PTE_P;
+	return true;
+}
+
+/* Splits the 2 MB page that maps VA in PML4 into 4 kB pages with
+ * the same flags, using TABLE, a free kernel page, as their page
+ * table.  Used for transparent huge user pages, which set TABLE
+ * aside when they are mapped, so that splitting never fails. */
+void
+pml4_split_large_page (uint64_t *pml4, uint64_t va, uint64_t *table) {
+	uint64_t *pde = pml4e_walk (pml4, va, false);
+
+	ASSERT (pde != NULL && (*pde & PTE_PS));
+	split_large_page (pde, PGSIZE_2M, va, table);
+	tlb_flush_page (pml4, va);
+}
+
 /* Creates a new page map level 4 (pml4) has mappings for kernel
  * virtual addresses, but none for user virtual addresses.
  * Returns the new page directory, or a null pointer if memory
@@ -122,7 +282,13 @@ pgdir_for_each (uint64_t *pdp, pte_for_each_func *func, void *aux,
 		unsigned pml4_index, unsigned pdp_index) {
 	for (unsigned i = 0; i < PGSIZE / sizeof(uint64_t *); i++) {
 		uint64_t *pte = ptov((uint64_t *) pdp[i]);
-		if (((uint64_t) pte) & PTE_P)
+		if ((pdp[i] & (PTE_P | PTE_PS)) == (PTE_P | PTE_PS)) {
+			void *va = (void *) (((uint64_t) pml4_index << PML4SHIFT) |
+								 ((uint64_t) pdp_index << PDPESHIFT) |
+								 ((uint64_t) i << PDXSHIFT));
+			if (!func (&pdp[i], va, aux))
+				return false;
+		} else if (((uint64_t) pte) & PTE_P)
 			if (!pt_for_each ((uint64_t *) PTE_ADDR (pte), func, aux,
 					pml4_index, pdp_index, i))
 				return false;
@@ -135,7 +301,12 @@ pdp_for_each (uint64_t *pdp,
 		pte_for_each_func *func, void *aux, unsigned pml4_index) {
 	for (unsigned i = 0; i < PGSIZE / sizeof(uint64_t *); i++) {
 		uint64_t *pde = ptov((uint64_t *) pdp[i]);
-		if (((uint64_t) pde) & PTE_P)
+		if ((pdp[i] & (PTE_P | PTE_PS)) == (PTE_P | PTE_PS)) {
+			void *va = (void *) (((uint64_t) pml4_index << PML4SHIFT) |
+								 ((uint64_t) i << PDPESHIFT));
+			if (!func (&pdp[i], va, aux))
+				return false;
+		} else if (((uint64_t) pde) & PTE_P)
 			if (!pgdir_for_each ((uint64_t *) PTE_ADDR (pde), func,
 					 aux, pml4_index, i))
 				return false;
@@ -143,7 +314,9 @@ pdp_for_each (uint64_t *pdp,
 	return true;
 }
 
-/* Apply FUNC to each available pte entries including kernel's. */
+/* Apply FUNC to each available pte entries including kernel's.
+ * A large page is passed once, as its PDE or PDPE with PTE_PS set,
+ * at the address it starts at. */
 bool
 pml4_for_each (uint64_t *pml4, pte_for_each_func *func, void *aux) {
 	for (unsigned i = 0; i < PGSIZE / sizeof(uint64_t *); i++) {
@@ -169,7 +342,8 @@ static void
 pgdir_destroy (uint64_t *pdp) {
 	for (unsigned i = 0; i < PGSIZE / sizeof(uint64_t *); i++) {
 		uint64_t *pte = ptov((uint64_t *) pdp[i]);
-		if (((uint64_t) pte) & PTE_P)
+		/* A 2 MB page has no table; its frames belong to the VM. */
+		if ((((uint64_t) pte) & PTE_P) && !(pdp[i] & PTE_PS))
 			pt_destroy (PTE_ADDR (pte));
 	}
 	palloc_free_page ((void *) pdp);
@@ -196,14 +370,109 @@ pml4_destroy (uint64_t *pml4) {
 	uint64_t *pdpe = ptov ((uint64_t *) pml4[0]);
 	if (((uint64_t) pdpe) & PTE_P)
 		pdpe_destroy ((void *) PTE_ADDR (pdpe));
+
+	/* Give back its PCID; whoever takes it next flushes it. */
+	enum intr_level old_level = intr_disable ();
+	struct pcid *pcid = pcid_find (pml4);
+	if (pcid != NULL)
+		pcid->pml4 = NULL;
+	intr_set_level (old_level);
+
 	palloc_free_page ((void *) pml4);
 }
 
+/* Turns on PCIDs if the CPU has them.  See [IA32-v2a] "CPUID",
+ * leaf 1, ECX bit 17.  Must be called with base_pml4 active under
+ * PCID 0. */
+void
+pml4_pcid_init (void) {
+	uint32_t eax, ebx, ecx, edx;
+
+	asm volatile ("cpuid"
+			: "=a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx)
+			: "a" (1));
+	if (!((ecx >> 17) & 1))
+		return;
+	lcr4 (rcr4 () | CR4_PCIDE);
+	pcid_enabled = true;
+}
+
+/* Returns the PCID entry of PML4, or a null pointer if it has
+ * none. */
+static struct pcid *
+pcid_find (uint64_t *pml4) {
+	for (int i = 1; i < PCID_CNT; i++)
+		if (pcids[i].pml4 == pml4)
+			return &pcids[i];
+	return NULL;
+}
+
+/* Gives PML4 a PCID, taking it from the page table that was
+ * activated least recently if none is free.  The PCID may still
+ * have TLB entries of its last page table, so it starts stale. */
+static struct pcid *
+pcid_alloc (uint64_t *pml4) {
+	struct pcid *victim = &pcids[1];
+
+	for (int i = 1; i < PCID_CNT; i++) {
+		if (pcids[i].pml4 == NULL) {
+			victim = &pcids[i];
+			break;
+		}
+		if (pcids[i].last_use < victim->last_use)
+			victim = &pcids[i];
+	}
+	victim->pml4 = pml4;
+	victim->stale = true;
+	return victim;
+}
+
+/* Makes sure that no TLB entry for VA in PML4 survives a change to
+ * its PTE: invlpg takes care of it if PML4 is active; otherwise
+ * PML4's PCID, if it has one, is flushed on its next activation. */
+static void
+tlb_flush_page (uint64_t *pml4, uint64_t va) {
+	if (PTE_ADDR (rcr3 ()) == vtop (pml4))
+		invlpg (va);
+	else if (pcid_enabled) {
+		enum intr_level old_level = intr_disable ();
+		struct pcid *pcid = pcid_find (pml4);
+
+		if (pcid != NULL)
+			pcid->stale = true;
+		intr_set_level (old_level);
+	}
+}
+
 /* Loads page directory PD into the CPU's page directory base
- * register. */
+ * register.  With PCIDs, the TLB entries of PML4 left from its last
+ * activation are kept, unless they went stale. */
 void
 pml4_activate (uint64_t *pml4) {
-	lcr3 (vtop (pml4 ? pml4 : base_pml4));
+	enum intr_level old_level;
+	struct pcid *pcid;
+	uint64_t cr3;
+
+	if (pml4 == NULL)
+		pml4 = base_pml4;
+	if (!pcid_enabled || pml4 == base_pml4) {
+		/* base_pml4 maps only the kernel, which every page table
+		 * maps the same way, so PCID 0 never goes stale. */
+		lcr3 (vtop (pml4) | (pcid_enabled ? CR3_NOFLUSH : 0));
+		return;
+	}
+
+	old_level = intr_disable ();
+	pcid = pcid_find (pml4);
+	if (pcid == NULL)
+		pcid = pcid_alloc (pml4);
+	pcid->last_use = ++pcid_clock;
+	cr3 = vtop (pml4) | (pcid - pcids);
+	if (!pcid->stale)
+		cr3 |= CR3_NOFLUSH;
+	pcid->stale = false;
+	lcr3 (cr3);
+	intr_set_level (old_level);
 }
 
 /* Looks up the physical address that corresponds to user virtual
@@ -214,10 +483,12 @@ void *
 pml4_get_page (uint64_t *pml4, const void *uaddr) {
 	ASSERT (is_user_vaddr (uaddr));
 
-	uint64_t *pte = pml4e_walk (pml4, (uint64_t) uaddr, 0);
+	uint64_t size;
+	uint64_t *pte = pml4_lookup (pml4, (uint64_t) uaddr, &size);
 
-	if (pte && (*pte & PTE_P))
-		return ptov (PTE_ADDR (*pte)) + pg_ofs (uaddr);
+	if (pte)
+		return ptov (PTE_ADDR (*pte) & ~(size - 1))
+			+ ((uint64_t) uaddr & (size - 1));
 	return NULL;
 }
 
@@ -243,6 +514,108 @@ pml4_set_page (uint64_t *pml4, void *upage, void *kpage, bool rw) {
 	return pte != NULL;
 }
 
+/* Largest range, in pages, whose TLB entries the range functions
+ * below drop one by one with invlpg.  For a larger range, reloading
+ * CR3 to flush everything is cheaper. */
+#define RANGE_INVLPG_MAX 32
+
+/* Returns the lowest-level entry on the way to VA in PML4, a PTE or
+ * the PDE or PDPE of a large page, and stores the size of the memory
+ * it maps in *SIZE.  If a table on the way is missing, returns a null
+ * pointer with *SIZE set to the size of the memory the missing table
+ * would map. */
+static uint64_t *
+range_walk (uint64_t *pml4, uint64_t va, uint64_t *size) {
+	uint64_t *table = pml4;
+
+	for (int level = 0; ; level++) {
+		uint64_t *e = &table[(va >> walk_shift[level]) & 0x1FF];
+
+		*size = 1UL << walk_shift[level];
+		if (level == 3 || (level > 0 && (*e & PTE_PS)))
+			return e;
+		if (!(*e & PTE_P))
+			return NULL;
+		table = ptov (PTE_ADDR (*e));
+	}
+}
+
+/* Drops the TLB entries for the CNT pages from VA in PML4 after a
+ * change to their PTEs: with invlpg for a few pages, by reloading
+ * CR3 for more.  If PML4 is not active, its PCID is flushed on its
+ * next activation instead. */
+static void
+tlb_flush_range (uint64_t *pml4, uint64_t va, size_t cnt) {
+	if (PTE_ADDR (rcr3 ()) != vtop (pml4))
+		tlb_flush_page (pml4, va);
+	else if (cnt <= RANGE_INVLPG_MAX) {
+		for (size_t i = 0; i < cnt; i++)
+			invlpg (va + i * PGSIZE);
+	} else {
+		/* Without the no-flush bit, this flushes the current PCID. */
+		lcr3 (rcr3 ());
+	}
+}
+
+/* Sets *PTE = (*PTE & ~CLEAR) | SET in the present PTEs of the CNT
+ * user pages from UPAGE in PML4, walking from the root once per page
+ * table, and flushes the TLB once for the whole range.  Parts of the
+ * range with nothing mapped are skipped quickly.  A large page must
+ * lie wholly inside or outside the range; its one entry is
+ * updated. */
+static void
+range_update (uint64_t *pml4, void *upage, size_t cnt,
+		uint64_t clear, uint64_t set) {
+	uint64_t va = (uint64_t) upage;
+	uint64_t end = va + cnt * PGSIZE;
+
+	ASSERT (pg_ofs (upage) == 0);
+	ASSERT (is_user_vaddr (upage));
+	ASSERT (cnt == 0 || is_user_vaddr ((void *) (end - 1)));
+
+	while (va < end) {
+		uint64_t size;
+		uint64_t *pte = range_walk (pml4, va, &size);
+
+		if (pte == NULL || size > PGSIZE) {
+			/* Nothing mapped, or a large page. */
+			if (pte != NULL && (*pte & PTE_P)) {
+				ASSERT (va % size == 0 && va + size <= end);
+				*pte = (*pte & ~clear) | set;
+			}
+			va = (va & ~(size - 1)) + size;
+			continue;
+		}
+
+		/* The rest of this page table. */
+		do {
+			if (*pte & PTE_P)
+				*pte = (*pte & ~clear) | set;
+			pte++;
+			va += PGSIZE;
+		} while (va < end && PTX (va) != 0);
+	}
+	tlb_flush_range (pml4, (uint64_t) upage, cnt);
+}
+
+/* Marks the CNT user pages from UPAGE "not present" in PML4, like
+ * that many calls to pml4_clear_page() but with one walk per page
+ * table and one TLB flush. */
+void
+pml4_clear_range (uint64_t *pml4, void *upage, size_t cnt) {
+	range_update (pml4, upage, cnt, PTE_P, 0);
+}
+
+/* Makes the present mappings of the CNT user pages from UPAGE in
+ * PML4 read/write if WRITABLE, read-only otherwise, like that many
+ * calls to pml4_set_writable() but with one walk per page table and
+ * one TLB flush. */
+void
+pml4_protect_range (uint64_t *pml4, void *upage, size_t cnt, bool writable) {
+	range_update (pml4, upage, cnt, writable ? 0 : PTE_W,
+			writable ? PTE_W : 0);
+}
+
 /* Marks user virtual page UPAGE "not present" in page
  * directory PD.  Later accesses to the page will fault.  Other
  * bits in the page table entry are preserved.
@@ -257,8 +630,29 @@ pml4_clear_page (uint64_t *pml4, void *upage) {
 
 	if (pte != NULL && (*pte & PTE_P) != 0) {
 		*pte &= ~PTE_P;
-		if (rcr3 () == vtop (pml4))
-			invlpg ((uint64_t) upage);
+		tlb_flush_page (pml4, (uint64_t) upage);
+	}
+}
+
+/* Makes the present mapping of user virtual page UPAGE in PML4
+ * read/write if WRITABLE is true, read-only otherwise, keeping the
+ * frame and the accessed and dirty bits as they are.
+ * UPAGE need not be mapped. */
+void
+pml4_set_writable (uint64_t *pml4, void *upage, bool writable) {
+	uint64_t *pte;
+	ASSERT (pg_ofs (upage) == 0);
+	ASSERT (is_user_vaddr (upage));
+
+	pte = pml4e_walk (pml4, (uint64_t) upage, false);
+
+	if (pte != NULL && (*pte & PTE_P) != 0) {
+		if (writable)
+			*pte |= PTE_W;
+		else
+			*pte &= ~(uint64_t) PTE_W;
+
+		tlb_flush_page (pml4, (uint64_t) upage);
 	}
 }
 
@@ -281,10 +675,9 @@ pml4_set_dirty (uint64_t *pml4, const void *vpage, bool dirty) {
 		if (dirty)
 			*pte |= PTE_D;
 		else
-			*pte &= ~(uint32_t) PTE_D;
+			*pte &= ~(uint64_t) PTE_D;
 
-		if (rcr3 () == vtop (pml4))
-			invlpg ((uint64_t) vpage);
+		tlb_flush_page (pml4, (uint64_t) vpage);
 	}
 }
 
@@ -307,9 +700,8 @@ pml4_set_accessed (uint64_t *pml4, const void *vpage, bool accessed) {
 		if (accessed)
 			*pte |= PTE_A;
 		else
-			*pte &= ~(uint32_t) PTE_A;
+			*pte &= ~(uint64_t) PTE_A;
 
-		if (rcr3 () == vtop (pml4))
-			invlpg ((uint64_t) vpage);
+		tlb_flush_page (pml4, (uint64_t) vpage);
 	}
 }
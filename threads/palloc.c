@@ -8,9 +8,13 @@
 #include <stdio.h>
 #include <string.h>
 #include "threads/init.h"
+#include "threads/interrupt.h"
 #include "threads/loader.h"
 #include "threads/synch.h"
 #include "threads/vaddr.h"
+#ifdef VM
+#include "vm/compact.h"
+#endif
 
 /* Page allocator.  Hands out memory in page-size (or
    page-multiple) chunks.  See malloc.h for an allocator that
@@ -24,13 +28,48 @@
 
    By default, half of system RAM is given to the kernel pool and
    half to the user pool.  That should be huge overkill for the
-   kernel pool, but that's just fine for demonstration purposes. */
+   kernel pool, but that's just fine for demonstration purposes.
+
+   Each pool also keeps a small list of pages that the idle thread
+   has already filled with zeros (see palloc_prezero_page()).  A
+   single-page PAL_ZERO request is served from that list first, so
+   the caller skips the memset.  Pages on the list are marked used
+   in the bitmap; the list is linked through the first word of
+   each page, which is cleared again when the page is handed
+   out.
+
+   Under VM, a multi-page user request that finds no free run gets
+   one by compaction: the frames in the range of the pool that needs
+   the fewest moves are moved elsewhere (see vm/compact.c).
+
+   With -pool-borrow, a request that its own pool cannot serve
+   borrows the pages from the other pool instead, so that free
+   kernel memory is not left idle while user processes swap, or
+   the other way round.  A pool lends only while it keeps at least
+   palloc_reserve pages free for itself, and no more than
+   palloc_borrow_max of its pages at a time.  A borrowed page stays
+   in the lender's bitmap, marked in its lent_map, and goes back to
+   the lender when it is freed. */
+
+/* Upper bound on pre-zeroed pages parked per pool.  Kept small so
+   that parked pages do not fragment multi-page allocations. */
+#define ZEROED_MAX 64
+
+/* Ranges compaction tries before giving up on a request. */
+#define COMPACT_TRIES 4
 
 /* A memory pool. */
 struct pool {
 	struct lock lock;               /* Mutual exclusion. */
 	struct bitmap *used_map;        /* Bitmap of free pages. */
 	uint8_t *base;                  /* Base of pool. */
+	void *zeroed;                   /* Singly linked pre-zeroed pages. */
+	size_t zeroed_cnt;              /* Number of pages in ZEROED. */
+	size_t zeroed_max;              /* Bound on ZEROED_CNT. */
+	struct bitmap *lent_map;        /* Pages lent to the other pool. */
+	size_t lent_cnt;                /* Number of pages in LENT_MAP. */
+	long long empty_cnt;            /* Requests it could not serve... */
+	long long borrow_cnt;           /* ...that the other pool did. */
 };
 
 /* Two pools: one for kernel data, one for user pages. */
@@ -38,10 +77,21 @@ static struct pool kernel_pool, user_pool;
 
 /* Maximum number of pages to put in user pool. */
 size_t user_page_limit = SIZE_MAX;
+
+/* Most pages either pool lends the other at a time; zero, the
+   default, turns borrowing off.  A pool keeps at least
+   PALLOC_RESERVE of its own pages free however much is asked. */
+size_t palloc_borrow_max;
+size_t palloc_reserve = 256;
 static void
 init_pool (struct pool *p, void **bm_base, uint64_t start, uint64_t end);
 
 static bool page_from_pool (const struct pool *, void *page);
+static void *zeroed_pop (struct pool *);
+static void zeroed_release (struct pool *);
+static size_t compact (struct pool *, size_t page_cnt, size_t align);
+static size_t scan_aligned (struct pool *, size_t page_cnt, size_t align);
+static void *borrow (struct pool *, size_t page_cnt, size_t align);
 
 /* multiboot info */
 struct multiboot_info {
@@ -262,16 +312,100 @@ palloc_init (void) {
 void *
 palloc_get_multiple (enum palloc_flags flags, size_t page_cnt) {
 	struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
+	void *pages = NULL;
+	bool zeroed = false;
+
+	lock_acquire (&pool->lock);
+	if (page_cnt == 1 && (flags & PAL_ZERO)) {
+		pages = zeroed_pop (pool);
+		zeroed = pages != NULL;
+	}
+	if (pages == NULL) {
+		size_t page_idx = bitmap_scan_and_flip (pool->used_map, 0, page_cnt,
+				false);
+		if (page_idx == BITMAP_ERROR && pool->zeroed_cnt > 0) {
+			/* Parked pages may be exactly what we are missing. */
+			if (page_cnt == 1) {
+				pages = zeroed_pop (pool);
+				zeroed = true;
+			} else {
+				zeroed_release (pool);
+				page_idx = bitmap_scan_and_flip (pool->used_map, 0, page_cnt,
+						false);
+			}
+		}
+		if (page_idx != BITMAP_ERROR)
+			pages = pool->base + PGSIZE * page_idx;
+	}
+	lock_release (&pool->lock);
+
+	if (pages == NULL && page_cnt > 1) {
+		size_t page_idx = compact (pool, page_cnt, 1);
+		if (page_idx != BITMAP_ERROR)
+			pages = pool->base + PGSIZE * page_idx;
+	}
+	if (pages == NULL)
+		pages = borrow (pool, page_cnt, 1);
+
+	if (pages) {
+		if ((flags & PAL_ZERO) && !zeroed)
+			memset (pages, 0, PGSIZE * page_cnt);
+	} else {
+		if (flags & PAL_ASSERT)
+			PANIC ("palloc_get: out of pages");
+	}
+
+	return pages;
+}
+
+/* Scans POOL for PAGE_CNT free pages in a row whose first page's
+   number is a multiple of ALIGN, marks them used and returns the
+   index of the first one, or BITMAP_ERROR if there is no such run.
+   POOL's lock must be held. */
+static size_t
+scan_aligned (struct pool *pool, size_t page_cnt, size_t align) {
+	size_t base = pg_no (pool->base);
+	size_t size = bitmap_size (pool->used_map);
+	size_t idx = ROUND_UP (base, align) - base;
+
+	while (idx <= size) {
+		idx = bitmap_scan (pool->used_map, idx, page_cnt, false);
+		if (idx == BITMAP_ERROR)
+			break;
+		if ((base + idx) % align == 0) {
+			bitmap_set_multiple (pool->used_map, idx, page_cnt, true);
+			return idx;
+		}
+		idx = ROUND_UP (base + idx, align) - base;
+	}
+	return BITMAP_ERROR;
+}
+
+/* Like palloc_get_multiple(), but the pages start at a physical
+   address that is a multiple of ALIGN pages, as a large page
+   needs. */
+void *
+palloc_get_aligned (enum palloc_flags flags, size_t page_cnt, size_t align) {
+	struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
+	void *pages = NULL;
+	size_t page_idx;
+
+	ASSERT (align > 0);
 
 	lock_acquire (&pool->lock);
-	size_t page_idx = bitmap_scan_and_flip (pool->used_map, 0, page_cnt, false);
+	page_idx = scan_aligned (pool, page_cnt, align);
+	if (page_idx == BITMAP_ERROR && pool->zeroed_cnt > 0) {
+		zeroed_release (pool);
+		page_idx = scan_aligned (pool, page_cnt, align);
+	}
 	lock_release (&pool->lock);
-	void *pages;
 
+	if (page_idx == BITMAP_ERROR)
+		page_idx = compact (pool, page_cnt, align);
 	if (page_idx != BITMAP_ERROR)
 		pages = pool->base + PGSIZE * page_idx;
 	else
-		pages = NULL;
+		pages = borrow (pool, page_cnt, align);
 
 	if (pages) {
 		if (flags & PAL_ZERO)
@@ -280,10 +414,171 @@ palloc_get_multiple (enum palloc_flags flags, size_t page_cnt) {
 		if (flags & PAL_ASSERT)
 			PANIC ("palloc_get: out of pages");
 	}
-
 	return pages;
 }
 
+#ifdef VM
+/* Picks the range of PAGE_CNT pages of POOL, starting at a multiple
+   of ALIGN, with the fewest pages in use, leaving out the TRIED_CNT
+   ranges at TRIED.  Marks its free pages used and sets their bits
+   in OWNED, so that neither the frames moved out of the range nor
+   anybody else land there meanwhile.  Returns the index of its first
+   page, or BITMAP_ERROR if there is no such range or the pool has
+   too few free pages to move the frames to. */
+static size_t
+claim_range (struct pool *pool, size_t page_cnt, size_t align,
+		const size_t tried[], size_t tried_cnt, struct bitmap *owned) {
+	size_t base = pg_no (pool->base);
+	size_t size = bitmap_size (pool->used_map);
+	size_t step = align > 1 ? align : page_cnt;
+	size_t best = BITMAP_ERROR, best_used = page_cnt;
+	size_t idx, i;
+
+	lock_acquire (&pool->lock);
+	zeroed_release (pool);
+	if (bitmap_count (pool->used_map, 0, size, false) >= page_cnt)
+		for (idx = ROUND_UP (base, step) - base; idx + page_cnt <= size;
+				idx += step) {
+			size_t used = bitmap_count (pool->used_map, idx, page_cnt, true);
+
+			for (i = 0; i < tried_cnt && tried[i] != idx; i++)
+				continue;
+			if (i == tried_cnt && used < best_used) {
+				best = idx;
+				best_used = used;
+			}
+		}
+	if (best != BITMAP_ERROR)
+		for (i = 0; i < page_cnt; i++)
+			if (!bitmap_test (pool->used_map, best + i)) {
+				bitmap_mark (pool->used_map, best + i);
+				bitmap_mark (owned, i);
+			}
+	lock_release (&pool->lock);
+	return best;
+}
+
+/* Makes a run of PAGE_CNT free pages in POOL, whose first page's
+   number is a multiple of ALIGN, by moving the frames out of a
+   range with few of them in use, trying up to COMPACT_TRIES ranges
+   in case some page of one cannot move.  Marks the run used and
+   returns the index of its first page, or BITMAP_ERROR on failure
+   or if POOL is not the user pool.  POOL's lock must not be held. */
+static size_t
+compact (struct pool *pool, size_t page_cnt, size_t align) {
+	size_t tried[COMPACT_TRIES];
+	struct bitmap *owned;
+	size_t try, i;
+
+	if (pool != &user_pool)
+		return BITMAP_ERROR;
+	owned = bitmap_create (page_cnt);
+	if (owned == NULL)
+		return BITMAP_ERROR;
+
+	for (try = 0; try < COMPACT_TRIES; try++) {
+		size_t idx = claim_range (pool, page_cnt, align, tried, try, owned);
+
+		if (idx == BITMAP_ERROR)
+			break;
+		if (compact_migrate (pool->base + PGSIZE * idx, page_cnt, owned)) {
+			bitmap_destroy (owned);
+			return idx;
+		}
+
+		/* Give back what we hold of the range, emptied pages too. */
+		lock_acquire (&pool->lock);
+		for (i = 0; i < page_cnt; i++)
+			if (bitmap_test (owned, i))
+				bitmap_reset (pool->used_map, idx + i);
+		lock_release (&pool->lock);
+		bitmap_set_all (owned, false);
+		tried[try] = idx;
+	}
+	bitmap_destroy (owned);
+	return BITMAP_ERROR;
+}
+#else
+/* Without VM, user pages cannot move. */
+static size_t
+compact (struct pool *pool UNUSED, size_t page_cnt UNUSED,
+		size_t align UNUSED) {
+	return BITMAP_ERROR;
+}
+#endif
+
+/* Makes sure the user pool has a free run of PAGE_CNT pages whose
+   first page's number is a multiple of ALIGN, compacting it if need
+   be.  Returns true if it has one. */
+bool
+palloc_compact (size_t page_cnt, size_t align) {
+	struct pool *pool = &user_pool;
+	size_t page_idx;
+
+	lock_acquire (&pool->lock);
+	page_idx = scan_aligned (pool, page_cnt, align);
+	lock_release (&pool->lock);
+	if (page_idx == BITMAP_ERROR)
+		page_idx = compact (pool, page_cnt, align);
+	if (page_idx == BITMAP_ERROR)
+		return false;
+
+	lock_acquire (&pool->lock);
+	bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+	lock_release (&pool->lock);
+	return true;
+}
+
+/* Returns the pool POOL borrows from. */
+static struct pool *
+other_pool (struct pool *pool) {
+	return pool == &user_pool ? &kernel_pool : &user_pool;
+}
+
+/* Returns the number of pages LENDER could lend now.  Taken without
+   its lock, so it is only a snapshot. */
+static size_t
+lendable_cnt (struct pool *lender) {
+	size_t free_cnt = bitmap_count (lender->used_map, 0,
+			bitmap_size (lender->used_map), false);
+	size_t spare = free_cnt > palloc_reserve ? free_cnt - palloc_reserve : 0;
+	size_t room = palloc_borrow_max > lender->lent_cnt
+		? palloc_borrow_max - lender->lent_cnt : 0;
+
+	return spare < room ? spare : room;
+}
+
+/* Records that POOL could not serve a request for PAGE_CNT pages
+   starting at a multiple of ALIGN, and serves it from the other
+   pool if that can spare them.  Returns the pages, or a null
+   pointer.  Neither pool's lock may be held. */
+static void *
+borrow (struct pool *pool, size_t page_cnt, size_t align) {
+	struct pool *lender = other_pool (pool);
+	size_t page_idx = BITMAP_ERROR;
+	enum intr_level old_level;
+
+	pool->empty_cnt++;
+	if (palloc_borrow_max == 0 || lender->used_map == NULL)
+		return NULL;
+
+	lock_acquire (&lender->lock);
+	if (lendable_cnt (lender) >= page_cnt)
+		page_idx = scan_aligned (lender, page_cnt, align);
+	if (page_idx != BITMAP_ERROR) {
+		/* The counts also change in palloc_free_multiple(), which
+		   does not take the lock. */
+		old_level = intr_disable ();
+		bitmap_set_multiple (lender->lent_map, page_idx, page_cnt, true);
+		lender->lent_cnt += page_cnt;
+		pool->borrow_cnt++;
+		intr_set_level (old_level);
+	}
+	lock_release (&lender->lock);
+
+	return page_idx != BITMAP_ERROR ? lender->base + PGSIZE * page_idx : NULL;
+}
+
 /* Obtains a single free page and returns its kernel virtual
    address.
    If PAL_USER is set, the page is obtained from the user pool,
@@ -319,6 +614,14 @@ palloc_free_multiple (void *pages, size_t page_cnt) {
 	memset (pages, 0xcc, PGSIZE * page_cnt);
 #endif
 	ASSERT (bitmap_all (pool->used_map, page_idx, page_cnt));
+	if (pool->lent_cnt > 0) {
+		enum intr_level old_level = intr_disable ();
+		size_t lent = bitmap_count (pool->lent_map, page_idx, page_cnt, true);
+
+		bitmap_set_multiple (pool->lent_map, page_idx, page_cnt, false);
+		pool->lent_cnt -= lent;
+		intr_set_level (old_level);
+	}
 	bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
 }
 
@@ -328,18 +631,149 @@ palloc_free_page (void *page) {
 	palloc_free_multiple (page, 1);
 }
 
+/* Returns the number of free pages in the user pool, counting the
+   pre-zeroed ones and those the kernel pool could lend it.  Taken
+   without the pool lock, so it is only a snapshot. */
+size_t
+palloc_user_free_cnt (void) {
+	return bitmap_count (user_pool.used_map, 0,
+			bitmap_size (user_pool.used_map), false)
+		+ user_pool.zeroed_cnt
+		+ (palloc_borrow_max > 0 ? lendable_cnt (&kernel_pool) : 0);
+}
+
+/* Fills in ST with the state of the user pool if FLAGS has
+   PAL_USER, otherwise of the kernel pool. */
+void
+palloc_get_stats (enum palloc_flags flags, struct palloc_stats *st) {
+	struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
+
+	st->page_cnt = bitmap_size (pool->used_map);
+	st->free_cnt = bitmap_count (pool->used_map, 0, st->page_cnt, false)
+		+ pool->zeroed_cnt;
+	st->borrowed_cnt = other_pool (pool)->lent_cnt;
+	st->lent_cnt = pool->lent_cnt;
+	st->empty_cnt = pool->empty_cnt;
+	st->borrow_cnt = pool->borrow_cnt;
+}
+
+/* Prints the state of both pools. */
+void
+palloc_print_stats (void) {
+	static const char *names[] = { "Kernel", "User" };
+	enum palloc_flags flags[] = { 0, PAL_USER };
+	size_t i;
+
+	for (i = 0; i < 2; i++) {
+		struct palloc_stats st;
+
+		palloc_get_stats (flags[i], &st);
+		printf ("%s pool: %zu of %zu pages free, %zu borrowed, %zu lent; "
+				"empty %lld times, borrowed %lld times\n",
+				names[i], st.free_cnt, st.page_cnt, st.borrowed_cnt,
+				st.lent_cnt, st.empty_cnt, st.borrow_cnt);
+	}
+}
+
+/* Zeroes one free page in the background and parks it on its
+   pool's pre-zeroed list.  Called by the idle thread with
+   interrupts off; interrupts are enabled while the page is being
+   cleared so the zeroing never delays an interrupt.  Never
+   blocks.  Returns true if a page was zeroed, false if there was
+   nothing to do (or the pool was busy).  The pool lock is only
+   held with interrupts off, so the idle thread can never be
+   preempted while other threads wait on it. */
+bool
+palloc_prezero_page (void) {
+	struct pool *pools[] = { &user_pool, &kernel_pool };
+	size_t i;
+
+	for (i = 0; i < sizeof pools / sizeof *pools; i++) {
+		struct pool *pool = pools[i];
+		size_t page_idx;
+		void *page;
+
+		if (pool->used_map == NULL || pool->zeroed_cnt >= pool->zeroed_max)
+			continue;
+		if (!lock_try_acquire (&pool->lock))
+			continue;
+		page_idx = bitmap_scan_and_flip (pool->used_map, 0, 1, false);
+		lock_release (&pool->lock);
+		if (page_idx == BITMAP_ERROR)
+			continue;
+
+		page = pool->base + PGSIZE * page_idx;
+		enum intr_level old_level = intr_enable ();
+		memset (page, 0, PGSIZE);
+		intr_set_level (old_level);
+
+		/* The idle thread must not sleep on the pool lock.  If it
+		   was taken meanwhile, hand the page back (bitmap_reset()
+		   is atomic) and try again on a later pass. */
+		if (!lock_try_acquire (&pool->lock)) {
+			bitmap_reset (pool->used_map, page_idx);
+			return false;
+		}
+		*(void **) page = pool->zeroed;
+		pool->zeroed = page;
+		pool->zeroed_cnt++;
+		lock_release (&pool->lock);
+		return true;
+	}
+	return false;
+}
+
+/* Takes one page off POOL's pre-zeroed list and returns it, or a
+   null pointer if the list is empty.  POOL's lock must be held. */
+static void *
+zeroed_pop (struct pool *pool) {
+	void **page = pool->zeroed;
+
+	ASSERT (lock_held_by_current_thread (&pool->lock));
+	if (page == NULL)
+		return NULL;
+	pool->zeroed = *page;
+	pool->zeroed_cnt--;
+	*page = NULL;
+	return page;
+}
+
+/* Returns every parked pre-zeroed page of POOL to its bitmap so
+   that they can be part of a multi-page allocation again.  POOL's
+   lock must be held. */
+static void
+zeroed_release (struct pool *pool) {
+	void *page;
+
+	while ((page = zeroed_pop (pool)) != NULL)
+		bitmap_reset (pool->used_map, pg_no (page) - pg_no (pool->base));
+}
+
 /* Initializes pool P as starting at START and ending at END */
 static void
 init_pool (struct pool *p, void **bm_base, uint64_t start, uint64_t end) {
   /* We'll put the pool's used_map at its base.
-     Calculate the space needed for the bitmap
-     and subtract it from the pool's size. */
+     Calculate the space needed for the bitmap, its summary and the
+     lent_map and subtract it from the pool's size. */
 	uint64_t pgcnt = (end - start) / PGSIZE;
-	size_t bm_pages = DIV_ROUND_UP (bitmap_buf_size (pgcnt), PGSIZE) * PGSIZE;
+	size_t bm_size = bitmap_buf_size (pgcnt);
+	size_t sum_size = bitmap_summary_size (pgcnt);
+	size_t bm_pages = DIV_ROUND_UP (2 * bm_size + sum_size, PGSIZE) * PGSIZE;
 
 	lock_init(&p->lock);
-	p->used_map = bitmap_create_in_buf (pgcnt, *bm_base, bm_pages);
+	p->used_map = bitmap_create_in_buf (pgcnt, *bm_base, bm_size);
+	bitmap_attach_summary (p->used_map, (uint8_t *) *bm_base + bm_size,
+			sum_size);
+	p->lent_map = bitmap_create_in_buf (pgcnt,
+			(uint8_t *) *bm_base + bm_size + sum_size, bm_size);
+	bitmap_set_all (p->lent_map, false);
+	p->lent_cnt = 0;
+	p->empty_cnt = 0;
+	p->borrow_cnt = 0;
 	p->base = (void *) start;
+	p->zeroed = NULL;
+	p->zeroed_cnt = 0;
+	p->zeroed_max = pgcnt / 16 < ZEROED_MAX ? pgcnt / 16 : ZEROED_MAX;
 
 	// Mark all to unusable.
 	bitmap_set_all(p->used_map, true);
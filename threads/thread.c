@@ -832,6 +832,41 @@ void thread_set_priority(int new_priority) {
 */
 int thread_get_priority(void) { return thread_current()->priority; }
 
+/* ------------ added for the reaper ------------ */
+
+/**
+ * @brief T의 우선순위를 NEW_PRIORITY로 바꾼다. T가 ready_list에 있다면
+ *        자리를 옮겨 준다.
+ *
+ * @details Unlike thread_set_priority(), T need not be the running
+ *          thread, and nothing is preempted: the caller, which may be
+ *          the scheduler itself, must have interrupts off.  Priority
+ *          donated to T still counts.
+ */
+void thread_set_priority_of(struct thread *t, int new_priority) {
+  struct list_elem *e;
+
+  ASSERT(is_thread(t));
+  ASSERT(intr_get_level() == INTR_OFF);
+
+  if (thread_mlfqs) return;
+
+  t->initial_priority = new_priority;
+  t->priority = new_priority;
+  for (e = list_begin(&t->donations); e != list_end(&t->donations);
+       e = list_next(e)) {
+    struct thread *donor = list_entry(e, struct thread, donation_elem);
+    if (t->priority < donor->priority) t->priority = donor->priority;
+  }
+
+  if (t->status == THREAD_READY) {
+    list_remove(&t->elem);
+    list_insert_ordered(&ready_list, &t->elem, cmp_ascending_priority, NULL);
+  }
+}
+
+/* ---------------------------------------------- */
+
 /* Idle thread.  Executes when no other thread is ready to run.
 
    The idle thread is initially put on the ready list by
@@ -852,6 +887,15 @@ static void idle(void *idle_started_ UNUSED) {
     intr_disable();
     thread_block();
 
+    /* ------------ added for page pre-zeroing ------------
+       ready_list가 비어 있는 동안에는 hlt 하기 전에 free page를 하나씩
+       미리 0으로 채워둔다. 한 페이지를 채울 때마다 다시 thread_block()을
+       거치므로 깨어난 thread가 있으면 즉시 CPU를 넘겨준다. */
+
+    if (palloc_prezero_page()) continue;
+
+    /* ---------------------------------------------------- */
+
     /* Re-enable interrupts and wait for the next one.
 
        The `sti' instruction disables interrupts until the
@@ -1087,6 +1131,14 @@ static void do_schedule(int status) {
   while (!list_empty(&destruction_req)) {
     struct thread *victim =
         list_entry(list_pop_front(&destruction_req), struct thread, elem);
+#ifdef USERPROG
+    /* A process's address space, and then the thread, are freed
+       by the reaper in userprog/process.c. */
+    if (victim->pml4 != NULL) {
+      process_reap(victim);
+      continue;
+    }
+#endif
     palloc_free_page(victim);
   }
   thread_current()->status = status;
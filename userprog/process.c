@@ -13,16 +13,21 @@
 #include "threads/flags.h"
 #include "threads/init.h"
 #include "threads/interrupt.h"
+#include "threads/malloc.h"
 #include "threads/palloc.h"
+#include "threads/synch.h"
 #include "threads/thread.h"
 #include "threads/mmu.h"
 #include "threads/vaddr.h"
 #include "intrinsic.h"
 #ifdef VM
 #include "vm/vm.h"
+#include "vm/uninit.h"
 #endif
 
 static void process_cleanup (void);
+static void process_detach (void);
+static void reaper (void *);
 static bool load (const char *file_name, struct intr_frame *if_);
 static void initd (void *f_name);
 static void __do_fork (void *);
@@ -33,6 +38,23 @@ process_init (void) {
 	struct thread *current = thread_current ();
 }
 
+/* Dead processes whose address spaces the reaper has yet to free,
+ * linked through their ELEM; a semaphore counting them; and whether
+ * the reaper is running at all.
+ *
+ * The reaper idles at PRI_MIN but runs at REAPER_PRI while
+ * REAP_LIST is not empty.  That stays below user work, which the
+ * reaper only fills the gaps of, a bounded batch of pages at a time
+ * (see supplemental_page_table_shrink()), but well above PRI_MIN,
+ * where any busy thread at all could keep it from running.  Frames
+ * it has yet to get to are taken by eviction without a write (see
+ * vm_evict_frame()). */
+#define REAPER_PRI (PRI_DEFAULT - 1)
+static struct list reap_list;
+static struct semaphore reap_sema;
+static struct thread *reaper_thread;
+static bool reaper_started;
+
 /* Starts the first userland program, called "initd", loaded from FILE_NAME.
  * The new thread may be scheduled (and may even exit)
  * before process_create_initd() returns. Returns the initd's
@@ -50,6 +72,12 @@ process_create_initd (const char *file_name) {
 		return TID_ERROR;
 	strlcpy (fn_copy, file_name, PGSIZE);
 
+	/* Start the reaper before there is anything to reap. */
+	list_init (&reap_list);
+	sema_init (&reap_sema, 0);
+	reaper_started = thread_create ("reaper", REAPER_PRI, reaper, NULL)
+		!= TID_ERROR;
+
 	/* Create a new thread to execute FILE_NAME. */
 	tid = thread_create (file_name, PRI_DEFAULT, initd, fn_copy);
 	if (tid == TID_ERROR)
@@ -175,6 +203,9 @@ process_exec (void *f_name) {
 
 	/* We first kill the current context */
 	process_cleanup ();
+#ifdef VM
+	supplemental_page_table_init (&thread_current ()->spt);
+#endif
 
 	/* And then load the binary */
 	success = load (file_name, &_if);
@@ -216,7 +247,65 @@ process_exit (void) {
 	 * TODO: project2/process_termination.html).
 	 * TODO: We recommend you to implement process resource cleanup here. */
 
-	process_cleanup ();
+	process_detach ();
+}
+
+/* Frees the resources of the exiting process, except its address
+ * space, which stays in place until the thread is gone and the
+ * reaper frees it (see process_reap()).  That way neither exit nor
+ * the parent's wait waits on freeing every frame and page table. */
+static void
+process_detach (void) {
+	if (!reaper_started) {
+		process_cleanup ();
+		return;
+	}
+#ifdef VM
+	/* Others may open the mapped files as soon as we are gone, so
+	 * their contents cannot wait for the reaper. */
+	file_writeback (&thread_current ()->spt, NULL, (void *) KERN_BASE);
+#endif
+}
+
+/* Hands T, a dead process whose struct thread is no longer in use,
+ * to the reaper, which frees its address space and then T itself.
+ * Called by the scheduler with interrupts off. */
+void
+process_reap (struct thread *t) {
+	ASSERT (intr_get_level () == INTR_OFF);
+	ASSERT (t->status == THREAD_DYING);
+
+	list_push_back (&reap_list, &t->elem);
+	if (reaper_thread != NULL)
+		thread_set_priority_of (reaper_thread, REAPER_PRI);
+	sema_up (&reap_sema);
+}
+
+/* Reaper thread: frees the address spaces of dead processes in the
+ * background, a batch of pages at a time, yielding in between. */
+static void
+reaper (void *aux UNUSED) {
+	reaper_thread = thread_current ();
+	for (;;) {
+		enum intr_level old_level;
+		struct thread *t;
+
+		/* Drop back to PRI_MIN only as we block, with interrupts off,
+		 * so that process_reap() finds us either boosted or asleep. */
+		old_level = intr_disable ();
+		if (list_empty (&reap_list))
+			thread_set_priority_of (reaper_thread, PRI_MIN);
+		sema_down (&reap_sema);
+		t = list_entry (list_pop_front (&reap_list), struct thread, elem);
+		intr_set_level (old_level);
+
+#ifdef VM
+		while (supplemental_page_table_shrink (&t->spt))
+			thread_yield ();
+#endif
+		pml4_destroy (t->pml4);
+		palloc_free_page (t);
+	}
 }
 
 /* Free the current process's resources. */
@@ -576,9 +665,18 @@ install_page (void *upage, void *kpage, bool writable) {
 
 static bool
 lazy_load_segment (struct page *page, void *aux) {
-	/* TODO: Load the segment from the file */
-	/* TODO: This called when the first page fault occurs on address VA. */
-	/* TODO: VA is available when calling this function. */
+	struct lazy_load_arg *arg = aux;
+	uint8_t *kva = page->frame->kva;
+	bool success;
+
+	success = file_read_at (arg->file, kva, arg->read_bytes, arg->ofs)
+		== (int) arg->read_bytes;
+	if (success)
+		memset (kva + arg->read_bytes, 0, arg->zero_bytes);
+
+	/* The page keeps ARG to load from again (see drop_page() in
+	 * vm/vm.c). */
+	return success;
 }
 
 /* Loads a segment starting at offset OFS in FILE at address
@@ -609,31 +707,73 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
 		size_t page_read_bytes = read_bytes < PGSIZE ? read_bytes : PGSIZE;
 		size_t page_zero_bytes = PGSIZE - page_read_bytes;
 
-		/* TODO: Set up aux to pass information to the lazy_load_segment. */
-		void *aux = NULL;
-		if (!vm_alloc_page_with_initializer (VM_ANON, upage,
-					writable, lazy_load_segment, aux))
-			return false;
+		/* Pages with nothing to read are plain zero-filled pages. */
+		if (page_read_bytes == 0) {
+			if (!vm_alloc_page (VM_ANON, upage, writable))
+				return false;
+		} else {
+			struct lazy_load_arg *aux = malloc (sizeof *aux);
+
+			if (aux == NULL)
+				return false;
+			aux->file = file_reopen (file);
+			if (aux->file == NULL) {
+				free (aux);
+				return false;
+			}
+			aux->ofs = ofs;
+			aux->read_bytes = page_read_bytes;
+			aux->zero_bytes = page_zero_bytes;
+			aux->map_cnt = 0;
+			aux->text = !writable;
+			/* Read-only pages stay backed by the file, so processes
+			 * running the same program share their frames.  The
+			 * file must not change under them. */
+			if (aux->text)
+				file_deny_write (aux->file);
+			if (!(writable
+					? vm_alloc_page_with_initializer (VM_ANON, upage, true,
+						lazy_load_segment, aux)
+					: vm_alloc_page_with_initializer (VM_FILE, upage, false,
+						NULL, aux))) {
+				lazy_load_arg_free (aux);
+				return false;
+			}
+		}
 
 		/* Advance. */
 		read_bytes -= page_read_bytes;
 		zero_bytes -= page_zero_bytes;
 		upage += PGSIZE;
+		ofs += page_read_bytes;
 	}
 	return true;
 }
 
-/* Create a PAGE of stack at the USER_STACK. Return true on success. */
+/* Pages of stack that setup_stack() puts in place up front. */
+#define STACK_PREFAULT 4
+
+/* Create the stack at the USER_STACK, with STACK_PREFAULT pages in
+ * place so that argument passing and the first calls do not fault.
+ * Only the top page is required.  Return true on success. */
 static bool
 setup_stack (struct intr_frame *if_) {
-	bool success = false;
-	void *stack_bottom = (void *) (((uint8_t *) USER_STACK) - PGSIZE);
-
-	/* TODO: Map the stack on stack_bottom and claim the page immediately.
-	 * TODO: If success, set the rsp accordingly.
-	 * TODO: You should mark the page is stack. */
-	/* TODO: Your code goes here */
+	struct supplemental_page_table *spt = &thread_current ()->spt;
+	uint8_t *va = (uint8_t *) USER_STACK - PGSIZE;
+	size_t i;
 
-	return success;
+	if (!vm_alloc_page (VM_ANON | VM_STACK, va, true) || !vm_claim_page (va))
+		return false;
+	spt->stack_bottom = va;
+	for (i = 1; i < STACK_PREFAULT && i < stack_limit; i++) {
+		va -= PGSIZE;
+		if (!vm_alloc_page (VM_ANON | VM_STACK, va, true))
+			break;
+		spt->stack_bottom = va;
+		if (!vm_claim_page (va))
+			break;
+	}
+	if_->rsp = USER_STACK;
+	return true;
 }
 #endif /* VM */
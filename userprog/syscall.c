@@ -7,6 +7,9 @@
 #include "userprog/gdt.h"
 #include "threads/flags.h"
 #include "intrinsic.h"
+#ifdef VM
+#include "vm/vm.h"
+#endif
 
 void syscall_entry (void);
 void syscall_handler (struct intr_frame *);
@@ -40,6 +43,21 @@ syscall_init (void) {
 /* The main system call interface */
 void
 syscall_handler (struct intr_frame *f UNUSED) {
+#ifdef VM
+	/* Page faults taken in the kernel on behalf of this call need the
+	 * user stack pointer to tell stack growth from a bad access. */
+	thread_current ()->user_rsp = (void *) f->rsp;
+
+	switch (f->R.rax) {
+		case SYS_MADVISE:
+			f->R.rax = vm_madvise ((void *) f->R.rdi, f->R.rsi, f->R.rdx)
+				? 0 : -1;
+			return;
+		case SYS_VMSTAT:
+			f->R.rax = vm_vmstat ((void *) f->R.rdi) ? 0 : -1;
+			return;
+	}
+#endif
 	// TODO: Your implementation goes here.
 	printf ("system call!\n");
 	thread_exit ();
@@ -1,7 +1,26 @@
 /* anon.c: Implementation of page for non-disk image (a.k.a. anonymous page). */
 
 #include "vm/vm.h"
+#include <bitmap.h>
+#include <list.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <vmstat.h>
 #include "devices/disk.h"
+#include "threads/malloc.h"
+#include "threads/mmu.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "vm/zswap.h"
+
+/* Number of sectors in a swap slot, which holds one page. */
+#define SECTORS_PER_SLOT (PGSIZE / DISK_SECTOR_SIZE)
+
+/* Most pages written out or read in together as one cluster. */
+#define SWAP_CLUSTER 8
 
 /* DO NOT MODIFY BELOW LINE */
 static struct disk *swap_disk;
@@ -17,11 +36,110 @@ static const struct page_operations anon_ops = {
 	.type = VM_ANON,
 };
 
+/* Swap slots.  SWAP_MAP has the slots in use.  SWAP_BUSY has the
+ * slots that the writer thread has yet to write, and SWAP_ORPHAN
+ * those among them whose page is gone, to be freed once written.
+ * SLOT_SHARES counts, for each slot, the pages sharing it beyond the
+ * first, forked copies of the page that went out to it; a slot is
+ * never written again while in use, so they all read back the same
+ * contents.  All of these, and the writer's queue, are protected by
+ * SWAP_LOCK. */
+static struct bitmap *swap_map;
+static struct bitmap *swap_busy;
+static struct bitmap *swap_orphan;
+static uint8_t *slot_shares;
+static struct lock swap_lock;
+static struct condition slot_written;   /* Some busy slots written. */
+
+/* A run of slots queued for the writer thread, with a copy of the
+ * pages to write taken when they were queued. */
+struct swap_write {
+	struct list_elem elem;
+	size_t slot;            /* First slot. */
+	size_t cnt;             /* Number of slots. */
+	void *buf;              /* CNT pages from palloc_get_multiple(). */
+};
+static struct list write_queue;
+static struct semaphore write_sema;     /* Up once per queued write. */
+static bool writer_started;
+
+/* Statistics. */
+static long long swap_reads;            /* Pages read from swap. */
+static long long swap_writes;           /* Pages written to swap. */
+static long long swap_writes_async;     /* ...of which by the writer. */
+
+static void swap_writer (void *aux);
+
 /* Initialize the data for anonymous pages */
 void
 vm_anon_init (void) {
-	/* TODO: Set up the swap_disk. */
-	swap_disk = NULL;
+	size_t slot_cnt;
+
+	swap_disk = disk_get (1, 1);
+	slot_cnt = swap_disk != NULL ? disk_size (swap_disk) / SECTORS_PER_SLOT : 0;
+	swap_map = bitmap_create (slot_cnt);
+	swap_busy = bitmap_create (slot_cnt);
+	swap_orphan = bitmap_create (slot_cnt);
+	slot_shares = calloc (slot_cnt + 1, sizeof *slot_shares);
+	if (swap_map == NULL || swap_busy == NULL || swap_orphan == NULL
+			|| slot_shares == NULL)
+		PANIC ("couldn't allocate swap map");
+	lock_init (&swap_lock);
+	cond_init (&slot_written);
+	list_init (&write_queue);
+	sema_init (&write_sema, 0);
+	zswap_init ();
+}
+
+/* Prints swap statistics. */
+void
+anon_print_stats (void) {
+	printf ("Swap: %lld pages read, %lld pages written (%lld in background)\n",
+			swap_reads, swap_writes, swap_writes_async);
+	zswap_print_stats ();
+}
+
+/* Fills in the swap counts of ST. */
+void
+anon_vmstat (struct vmstat *st) {
+	st->swap_ins = swap_reads;
+	st->swap_outs = swap_writes;
+}
+
+/* Allocates CNT contiguous swap slots and returns the first, or
+ * BITMAP_ERROR if there is no such run free. */
+static size_t
+slot_alloc (size_t cnt) {
+	size_t slot;
+
+	lock_acquire (&swap_lock);
+	slot = bitmap_scan_and_flip (swap_map, 0, cnt, false);
+	lock_release (&swap_lock);
+	return slot;
+}
+
+/* Releases SLOT, or marks it to be released once the writer thread
+ * is done with it, unless other pages still share it. */
+static void
+slot_free (size_t slot) {
+	lock_acquire (&swap_lock);
+	if (slot_shares[slot] > 0)
+		slot_shares[slot]--;
+	else if (bitmap_test (swap_busy, slot))
+		bitmap_mark (swap_orphan, slot);
+	else
+		bitmap_reset (swap_map, slot);
+	lock_release (&swap_lock);
+}
+
+/* Writes the page at KVA to SLOT. */
+static void
+slot_write (size_t slot, const void *kva) {
+	disk_sector_t sector = slot * SECTORS_PER_SLOT;
+	size_t i;
+
+	for (i = 0; i < SECTORS_PER_SLOT; i++)
+		disk_write (swap_disk, sector + i, kva + i * DISK_SECTOR_SIZE);
 }
 
 /* Initialize the file mapping */
@@ -29,24 +147,294 @@ bool
 anon_initializer (struct page *page, enum vm_type type, void *kva) {
 	/* Set up the handler */
 	page->operations = &anon_ops;
+	page->anon.slot = BITMAP_ERROR;
+	page->anon.zentry = NULL;
+	page->anon.init = NULL;
+	page->anon.load = NULL;
+	return true;
+}
 
-	struct anon_page *anon_page = &page->anon;
+/* Writes the page at KVA to a new swap slot for PAGE, which must
+ * not have one.  Used for pages leaving the zswap pool.  Returns
+ * false if swap is full. */
+bool
+anon_write_slot (struct page *page, const void *kva) {
+	ASSERT (page->anon.slot == BITMAP_ERROR);
+
+	page->anon.slot = slot_alloc (1);
+	if (page->anon.slot == BITMAP_ERROR)
+		return false;
+	slot_write (page->anon.slot, kva);
+	swap_writes++;
+	return true;
+}
+
+/* Gives PAGE a share of the swap slot of SRC, which holds the same
+ * contents, and returns true, unless the slot has as many sharers
+ * as it can count. */
+bool
+anon_share_slot (struct page *page, const struct page *src) {
+	bool ok;
+
+	ASSERT (src->anon.slot != BITMAP_ERROR);
+
+	lock_acquire (&swap_lock);
+	ok = slot_shares[src->anon.slot] < UINT8_MAX;
+	if (ok) {
+		slot_shares[src->anon.slot]++;
+		page->anon.slot = src->anon.slot;
+	}
+	lock_release (&swap_lock);
+	return ok;
+}
+
+/* Gives PAGE, a forked child's copy of SRC, which is out of memory,
+ * a share of SRC's copy in the zswap pool or in swap, so that fork
+ * need not bring it back in.  Returns false if that cannot be done.
+ * FRAME_LOCK must be held, so that SRC stays out of memory. */
+bool
+anon_share_swap (struct page *page, struct page *src) {
+	ASSERT (lock_held_by_current_thread (&frame_lock));
+	ASSERT (src->operations == &anon_ops && src->frame == NULL);
+
+	/* Should SRC's compressed copy spill to disk meanwhile, it has
+	 * its slot by the time zswap_share() fails. */
+	if (zswap_share (page, src))
+		return true;
+	return src->anon.slot != BITMAP_ERROR && anon_share_slot (page, src);
+}
+
+/* Returns true if PAGE is an anonymous page swapped out to the slot
+ * DELTA slots after BASE's, so that swap readahead can bring it in
+ * along with BASE. */
+bool
+anon_swapped_next_to (struct page *page, struct page *base, long delta) {
+	return page->operations == &anon_ops && page->frame == NULL
+		&& base->operations == &anon_ops
+		&& page->anon.slot != BITMAP_ERROR
+		&& base->anon.slot != BITMAP_ERROR
+		&& (long) (page->anon.slot - base->anon.slot) == delta;
 }
 
 /* Swap in the page by read contents from the swap disk. */
 static bool
 anon_swap_in (struct page *page, void *kva) {
 	struct anon_page *anon_page = &page->anon;
+	disk_sector_t sector;
+	size_t i;
+
+	if (zswap_load (page, kva))
+		return true;
+	if (anon_page->slot == BITMAP_ERROR)
+		return false;
+
+	/* The slot may still be queued for the writer thread. */
+	lock_acquire (&swap_lock);
+	while (bitmap_test (swap_busy, anon_page->slot))
+		cond_wait (&slot_written, &swap_lock);
+	lock_release (&swap_lock);
+
+	sector = anon_page->slot * SECTORS_PER_SLOT;
+	for (i = 0; i < SECTORS_PER_SLOT; i++)
+		disk_read (swap_disk, sector + i, kva + i * DISK_SECTOR_SIZE);
+	swap_reads++;
+	return true;
 }
 
-/* Swap out the page by writing contents to the swap disk. */
+/* Returns true if PAGE needs writing to swap before its frame can be
+ * reused: it has no slot yet, or it changed since it was written. */
+static bool
+needs_write (struct page *page) {
+	return page->anon.slot == BITMAP_ERROR
+		|| pml4_is_dirty (page->owner->pml4, page->va);
+}
+
+/* Returns the page at VA in PAGE's address space if it could go out
+ * to swap in the same cluster as PAGE: an anonymous page, resident
+ * in a frame of its own outside any huge page, that needs writing.
+ * The caller holds the owner's supplemental page table lock. */
+static struct page *
+cluster_neighbor (struct page *page, void *va) {
+	struct page *n;
+
+	if (!is_user_vaddr (va))
+		return NULL;
+	n = spt_find_page (&page->owner->spt, va);
+	if (n == NULL || n->operations != &anon_ops || n->frame == NULL
+			|| n->frame->share_cnt != 1 || n->frame->huge_pt != NULL
+			|| !needs_write (n))
+		return NULL;
+	return n;
+}
+
+/* Collects into RUN the cluster to write along with PAGE: the pages
+ * at consecutive addresses around PAGE that cluster_neighbor()
+ * accepts, up to SWAP_CLUSTER pages in all, in address order.
+ * Returns the number of pages and sets *IDX to PAGE's index.  Only
+ * PAGE is collected if its owner's table is busy. */
+static size_t
+cluster_gather (struct page *page, struct page *run[], size_t *idx) {
+	struct lock *spt_lock = &page->owner->spt.lock;
+	struct page *below[SWAP_CLUSTER];
+	size_t lo = 0, hi = 0, i;
+	struct page *n;
+
+	if (lock_try_acquire (spt_lock)) {
+		while (lo + 1 < SWAP_CLUSTER
+				&& (n = cluster_neighbor (page, page->va - (lo + 1) * PGSIZE)))
+			below[lo++] = n;
+		while (lo + hi + 1 < SWAP_CLUSTER
+				&& (n = cluster_neighbor (page, page->va + (hi + 1) * PGSIZE)))
+			run[lo + 1 + hi++] = n;
+		lock_release (spt_lock);
+	}
+
+	for (i = 0; i < lo; i++)
+		run[i] = below[lo - 1 - i];
+	run[lo] = page;
+	*idx = lo;
+	return lo + hi + 1;
+}
+
+/* Writes the CNT pages of RUN, just given consecutive slots, in the
+ * background: takes a copy of each and queues the copies for the
+ * writer thread.  Writes them at once if that cannot be arranged. */
+static void
+write_behind (struct page *run[], size_t cnt) {
+	struct swap_write *w = NULL;
+	void *buf = NULL;
+	size_t i;
+
+	if (cnt == 0)
+		return;
+	if (!writer_started)
+		writer_started = thread_create ("swapd", PRI_DEFAULT, swap_writer,
+				NULL) != TID_ERROR;
+	if (writer_started) {
+		w = malloc (sizeof *w);
+		buf = palloc_get_multiple (0, cnt);
+	}
+
+	for (i = 0; i < cnt; i++) {
+		struct page *p = run[i];
+
+		/* Clear the dirty bit before taking the copy: a write after
+		 * this point marks the page dirty again. */
+		pml4_set_dirty (p->owner->pml4, p->va, false);
+		if (w != NULL && buf != NULL)
+			memcpy (buf + i * PGSIZE, p->frame->kva, PGSIZE);
+		else {
+			slot_write (p->anon.slot, p->frame->kva);
+			swap_writes++;
+		}
+	}
+	if (w == NULL || buf == NULL) {
+		free (w);
+		if (buf != NULL)
+			palloc_free_multiple (buf, cnt);
+		return;
+	}
+
+	w->slot = run[0]->anon.slot;
+	w->cnt = cnt;
+	w->buf = buf;
+	lock_acquire (&swap_lock);
+	bitmap_set_multiple (swap_busy, w->slot, cnt, true);
+	list_push_back (&write_queue, &w->elem);
+	lock_release (&swap_lock);
+	sema_up (&write_sema);
+}
+
+/* Swap out the page by writing contents to the swap disk.
+ *
+ * Dirty neighbors of PAGE are given the adjacent slots and written
+ * out along with it, so that they can later leave memory without a
+ * write and come back by swap readahead.  Only PAGE is written
+ * before returning; the neighbors stay resident and are written by
+ * the writer thread. */
 static bool
 anon_swap_out (struct page *page) {
-	struct anon_page *anon_page = &page->anon;
+	struct page *run[SWAP_CLUSTER];
+	size_t cnt, idx, base, i;
+
+	/* Unchanged since it was last written to its slot. */
+	if (!needs_write (page))
+		return true;
+
+	/* The compressed pool, when there is one, takes what it can. */
+	if (zswap_store (page, page->frame->kva)) {
+		if (page->anon.slot != BITMAP_ERROR) {
+			slot_free (page->anon.slot);
+			page->anon.slot = BITMAP_ERROR;
+		}
+		return true;
+	}
+
+	cnt = cluster_gather (page, run, &idx);
+	base = slot_alloc (cnt);
+	if (base == BITMAP_ERROR && cnt > 1) {
+		run[0] = page;
+		cnt = 1;
+		idx = 0;
+		base = slot_alloc (1);
+	}
+	if (base == BITMAP_ERROR)
+		return false;
+
+	for (i = 0; i < cnt; i++) {
+		if (run[i]->anon.slot != BITMAP_ERROR)
+			slot_free (run[i]->anon.slot);
+		run[i]->anon.slot = base + i;
+	}
+
+	slot_write (page->anon.slot, page->frame->kva);
+	swap_writes++;
+
+	write_behind (run, idx);
+	write_behind (run + idx + 1, cnt - idx - 1);
+	return true;
+}
+
+/* Writer thread: writes queued runs of slots in the background and
+ * wakes up whoever waits for them. */
+static void
+swap_writer (void *aux UNUSED) {
+	for (;;) {
+		struct swap_write *w;
+		size_t i;
+
+		sema_down (&write_sema);
+		lock_acquire (&swap_lock);
+		w = list_entry (list_pop_front (&write_queue), struct swap_write, elem);
+		lock_release (&swap_lock);
+
+		for (i = 0; i < w->cnt; i++)
+			slot_write (w->slot + i, w->buf + i * PGSIZE);
+
+		lock_acquire (&swap_lock);
+		for (i = 0; i < w->cnt; i++) {
+			bitmap_reset (swap_busy, w->slot + i);
+			if (bitmap_test (swap_orphan, w->slot + i)) {
+				bitmap_reset (swap_orphan, w->slot + i);
+				bitmap_reset (swap_map, w->slot + i);
+			}
+		}
+		swap_writes += w->cnt;
+		swap_writes_async += w->cnt;
+		cond_broadcast (&slot_written, &swap_lock);
+		lock_release (&swap_lock);
+
+		palloc_free_multiple (w->buf, w->cnt);
+		free (w);
+	}
 }
 
 /* Destroy the anonymous page. PAGE will be freed by the caller. */
 static void
 anon_destroy (struct page *page) {
-	struct anon_page *anon_page = &page->anon;
+	vm_free_frame (page);
+	if (!zswap_invalidate (page) && page->anon.slot != BITMAP_ERROR)
+		slot_free (page->anon.slot);
+	if (page->anon.load != NULL)
+		lazy_load_arg_free (page->anon.load);
 }
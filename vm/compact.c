@@ -0,0 +1,181 @@
+/* compact.c: Moves user frames out of the way of large allocations.
+ *
+ * After a while the user pool is scattered with frames, and a run
+ * of contiguous pages, such as a huge page needs, cannot be had even
+ * though plenty of pages are free.  The page allocator then picks a
+ * range of the pool and asks compact_migrate() to move the frames in
+ * it elsewhere (see palloc.c).  A frame moves by copying it to a new
+ * page and pointing the PTEs of every page in its rmap at the copy.
+ *
+ * The frames of a huge page are part of a larger mapping and do not
+ * move.  Neither do frames not in the frame table at all, which are
+ * being loaded.
+ *
+ * kcompactd, a kernel thread, also compacts in the background, so
+ * that a free 2 MB run is ready before a huge page wants one.  It is
+ * off unless the kernel is given -kcompactd=MS. */
+
+#include "vm/compact.h"
+#include <bitmap.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/timer.h"
+#include "threads/malloc.h"
+#include "threads/mmu.h"
+#include "threads/palloc.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "vm/vm.h"
+
+unsigned compact_sleep_ms;
+
+/* Statistics. */
+static long long run_cnt;       /* Ranges tried. */
+static long long ok_cnt;        /* ...and freed. */
+static long long move_cnt;      /* Frames moved. */
+
+static void kcompactd (void *aux);
+
+/* Starts kcompactd, if -kcompactd was given. */
+void
+compact_init (void) {
+	if (compact_sleep_ms > 0)
+		thread_create ("kcompactd", PRI_DEFAULT, kcompactd, NULL);
+}
+
+/* Prints compaction statistics. */
+void
+compact_print_stats (void) {
+	if (run_cnt > 0)
+		printf ("Compaction: %lld of %lld ranges freed, %lld frames moved\n",
+				ok_cnt, run_cnt, move_cnt);
+}
+
+/* Returns true if FRAME may move to another page. */
+static bool
+frame_is_movable (struct frame *frame) {
+	return frame != NULL && frame->huge_pt == NULL;
+}
+
+/* Bits of a mapping that survive the move. */
+struct mapping {
+	bool present, writable, dirty, accessed;
+};
+
+/* Copies FRAME, a movable frame, to a new page outside the range
+ * being compacted and maps its pages there.  Returns false if there
+ * is no page to be had. */
+static bool
+move_frame (struct frame *frame) {
+	struct mapping *maps;
+	struct list_elem *e;
+	size_t i;
+	void *kva;
+
+	kva = palloc_get_page (PAL_USER);
+	maps = malloc (frame->share_cnt * sizeof *maps);
+	if (kva == NULL || maps == NULL) {
+		if (kva != NULL)
+			palloc_free_page (kva);
+		free (maps);
+		return false;
+	}
+
+	/* Unmap first, so that no owner can change the frame while it is
+	 * being copied; a fault meanwhile waits for the frame lock. */
+	for (e = list_begin (&frame->rmap), i = 0; e != list_end (&frame->rmap);
+			e = list_next (e), i++) {
+		struct page *page = list_entry (e, struct page, rmap_elem);
+		uint64_t *pml4 = page->owner->pml4;
+		uint64_t *pte = pml4e_walk (pml4, (uint64_t) page->va, 0);
+
+		maps[i].present = pte != NULL && (*pte & PTE_P);
+		if (!maps[i].present)
+			continue;
+		maps[i].writable = is_writable (pte);
+		maps[i].dirty = pml4_is_dirty (pml4, page->va);
+		maps[i].accessed = pml4_is_accessed (pml4, page->va);
+		pml4_clear_page (pml4, page->va);
+	}
+
+	memcpy (kva, frame->kva, PGSIZE);
+	frame->kva = kva;
+
+	for (e = list_begin (&frame->rmap), i = 0; e != list_end (&frame->rmap);
+			e = list_next (e), i++) {
+		struct page *page = list_entry (e, struct page, rmap_elem);
+		uint64_t *pml4 = page->owner->pml4;
+
+		if (!maps[i].present)
+			continue;
+		if (!pml4_set_page (pml4, page->va, kva, maps[i].writable)) {
+			/* The old mapping's page tables are still there. */
+			NOT_REACHED ();
+		}
+		pml4_set_dirty (pml4, page->va, maps[i].dirty);
+		pml4_set_accessed (pml4, page->va, maps[i].accessed);
+	}
+	free (maps);
+	return true;
+}
+
+/* Moves every frame in the PAGE_CNT pages at START, in the user
+ * pool, to pages elsewhere.  Bit I of OWNED is set for each page the
+ * caller already holds, and this sets it for each page it empties,
+ * which the caller then holds too.  Returns true if every page of
+ * the range ends up in OWNED.  Takes the frame lock, so it must not
+ * be held. */
+bool
+compact_migrate (void *start, size_t page_cnt, struct bitmap *owned) {
+	struct frame **frames;
+	struct list_elem *e;
+	bool success = true;
+	size_t i;
+
+	ASSERT (!lock_held_by_current_thread (&frame_lock));
+
+	frames = calloc (page_cnt, sizeof *frames);
+	if (frames == NULL)
+		return false;
+
+	lock_acquire (&frame_lock);
+	run_cnt++;
+	for (e = list_begin (&frame_table); e != list_end (&frame_table);
+			e = list_next (e)) {
+		struct frame *frame = list_entry (e, struct frame, elem);
+
+		if (frame->kva >= start && frame->kva < start + page_cnt * PGSIZE)
+			frames[(frame->kva - start) / PGSIZE] = frame;
+	}
+
+	/* Give up before moving anything if some page cannot move. */
+	for (i = 0; i < page_cnt && success; i++)
+		if (!bitmap_test (owned, i) && !frame_is_movable (frames[i]))
+			success = false;
+	for (i = 0; i < page_cnt && success; i++) {
+		if (bitmap_test (owned, i))
+			continue;
+		if (!move_frame (frames[i]))
+			success = false;
+		else {
+			bitmap_mark (owned, i);
+			move_cnt++;
+		}
+	}
+	if (success)
+		ok_cnt++;
+	lock_release (&frame_lock);
+
+	free (frames);
+	return success;
+}
+
+/* kcompactd's thread function: keeps a free 2 MB run in the user
+ * pool if there are free pages enough for one. */
+static void
+kcompactd (void *aux UNUSED) {
+	for (;;) {
+		timer_msleep (compact_sleep_ms);
+		palloc_compact (PGSIZE_2M / PGSIZE, PGSIZE_2M / PGSIZE);
+	}
+}
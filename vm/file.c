@@ -1,6 +1,14 @@
 /* file.c: Implementation of memory backed file object (mmaped object). */
 
 #include "vm/vm.h"
+#include <round.h>
+#include <stdio.h>
+#include <string.h>
+#include <vmstat.h>
+#include "threads/malloc.h"
+#include "threads/mmu.h"
+#include "threads/palloc.h"
+#include "threads/thread.h"
 
 static bool file_backed_swap_in (struct page *page, void *kva);
 static bool file_backed_swap_out (struct page *page);
@@ -14,45 +22,446 @@ static const struct page_operations file_ops = {
 	.type = VM_FILE,
 };
 
+/* The read-only pages of a program's executable are shared between
+ * processes: the frame holding some bytes of an inode is found in
+ * the text cache and mapped by every page of those bytes, so a
+ * second process running the same executable maps the frames the
+ * first one loaded, without reading the disk.
+ *
+ * Only pages load_segment() marks TEXT take part.  Each has its own
+ * file with writes denied, so the inode cannot change under a
+ * cached frame while any such page exists; other read-only file
+ * pages, such as those of mmap(), could see the file written and
+ * never share.  A cached frame's contents are always in the file, so
+ * eviction writes nothing for it.  A frame leaves the cache when it
+ * is evicted or its last page goes away.  The cache is protected by
+ * the frame lock. */
+struct text_frame {
+	struct inode *inode;        /* The file's inode... */
+	off_t ofs;                  /* ...the offset of the contents... */
+	size_t read_bytes;          /* ...and how many bytes there are. */
+	struct frame *frame;        /* Frame holding the contents. */
+	struct hash_elem elem;      /* Element in text_cache. */
+};
+
+static struct hash text_cache;
+
+/* Dirty pages of a file at consecutive addresses and offsets are
+ * written back together, copied into one buffer and written with a
+ * single file_write_at(), up to this many pages at a time. */
+#define WRITEBACK_MAX 16
+
+/* A run of dirty file pages being collected for writeback. */
+struct writeback {
+	struct page *run[WRITEBACK_MAX];
+	size_t cnt;
+};
+
+/* Statistics. */
+static long long text_hits;     /* Faults served by a cached frame. */
+static long long wb_runs;       /* Writes of dirty file pages... */
+static long long wb_pages;      /* ...and the pages they covered. */
+
+static uint64_t text_hash (const struct hash_elem *e, void *aux);
+static bool text_less (const struct hash_elem *a, const struct hash_elem *b,
+		void *aux);
+
 /* The initializer of file vm */
 void
 vm_file_init (void) {
+	hash_init (&text_cache, text_hash, text_less, NULL);
+}
+
+/* Prints text cache statistics. */
+void
+file_print_stats (void) {
+	printf ("Text cache: %lld shared faults, %zu frames\n",
+			text_hits, hash_size (&text_cache));
+	printf ("File writeback: %lld writes, %lld pages\n", wb_runs, wb_pages);
 }
 
-/* Initialize the file backed page */
+/* Fills in the writeback count of ST. */
+void
+file_vmstat (struct vmstat *st) {
+	st->writebacks = wb_pages;
+}
+
+/* Initialize the file backed page.  The page takes over the file of
+ * its load information, and reads its contents into KVA unless KVA
+ * is NULL. */
 bool
-file_backed_initializer (struct page *page, enum vm_type type, void *kva) {
+file_backed_initializer (struct page *page, enum vm_type type UNUSED,
+		void *kva) {
+	/* Fetch first, setting up the file page overwrites it. */
+	struct lazy_load_arg *arg = page->uninit.aux;
+
 	/* Set up the handler */
 	page->operations = &file_ops;
 
-	struct file_page *file_page = &page->file;
+	page->file = (struct file_page) {
+		.file = arg->file,
+		.ofs = arg->ofs,
+		.read_bytes = arg->read_bytes,
+		.zero_bytes = arg->zero_bytes,
+		.map_cnt = arg->map_cnt,
+		.text = arg->text,
+	};
+	free (arg);
+	return kva == NULL || file_backed_swap_in (page, kva);
+}
+
+/* Sets up PAGE as a file page of the same part of the same file as
+ * SRC, with its own reopened file and no frame.  Returns false if
+ * the file cannot be reopened. */
+bool
+file_page_dup (struct page *page, const struct page *src) {
+	page->operations = &file_ops;
+	page->file = src->file;
+	page->file.file = file_reopen (src->file.file);
+	if (page->file.file == NULL)
+		return false;
+	if (page->file.text)
+		file_deny_write (page->file.file);
+	return true;
 }
 
 /* Swap in the page by read contents from the file. */
 static bool
 file_backed_swap_in (struct page *page, void *kva) {
-	struct file_page *file_page UNUSED = &page->file;
+	struct file_page *file_page = &page->file;
+
+	if (file_read_at (file_page->file, kva, file_page->read_bytes,
+				file_page->ofs) != (int) file_page->read_bytes)
+		return false;
+	memset (kva + file_page->read_bytes, 0, file_page->zero_bytes);
+	return true;
+}
+
+/* Returns true if PAGE is a file page whose frame holds changes
+ * not yet written back to the file. */
+static bool
+needs_writeback (struct page *page) {
+	return page->operations == &file_ops && page->frame != NULL
+		&& pml4_is_dirty (page->owner->pml4, page->va);
+}
+
+/* Returns true if PAGE continues the contents of PREV in the file,
+ * at the next address, so that both can go out in one write. */
+static bool
+follows (const struct page *prev, const struct page *page) {
+	return page->va == prev->va + PGSIZE
+		&& page->file.ofs == prev->file.ofs + PGSIZE
+		&& prev->file.read_bytes == PGSIZE
+		&& file_get_inode (page->file.file) == file_get_inode (prev->file.file);
+}
+
+/* Writes the CNT pages of RUN, dirty file pages that follow() one
+ * another, back to their file with one write and marks them clean.
+ * Falls back to a write per page without memory for a buffer.
+ * Returns true if everything was written; pages that were not stay
+ * dirty. */
+static bool
+writeback_run (struct page *run[], size_t cnt) {
+	struct file_page *first = &run[0]->file;
+	off_t bytes = (cnt - 1) * PGSIZE + run[cnt - 1]->file.read_bytes;
+	void *buf = NULL;
+	bool ok = true;
+	size_t i;
+
+	ASSERT (lock_held_by_current_thread (&frame_lock));
+
+	if (cnt > 1 && (buf = palloc_get_multiple (0, cnt)) == NULL) {
+		for (i = 0; i < cnt; i++)
+			ok = writeback_run (run + i, 1) && ok;
+		return ok;
+	}
+
+	/* Clear the dirty bits before taking the copy: a write after
+	 * this point marks the page dirty again. */
+	for (i = 0; i < cnt; i++) {
+		pml4_set_dirty (run[i]->owner->pml4, run[i]->va, false);
+		if (buf != NULL)
+			memcpy (buf + i * PGSIZE, run[i]->frame->kva, PGSIZE);
+	}
+	ok = file_write_at (first->file, buf != NULL ? buf : run[0]->frame->kva,
+			bytes, first->ofs) == bytes;
+	if (buf != NULL)
+		palloc_free_multiple (buf, cnt);
+	if (!ok)
+		for (i = 0; i < cnt; i++)
+			pml4_set_dirty (run[i]->owner->pml4, run[i]->va, true);
+	wb_runs++;
+	wb_pages += cnt;
+	return ok;
+}
+
+/* Writes back and empties the run collected in WB. */
+static void
+writeback_flush (struct writeback *wb) {
+	if (wb->cnt > 0)
+		writeback_run (wb->run, wb->cnt);
+	wb->cnt = 0;
+}
+
+/* spt_for_each() action: adds PAGE to the run in WB_ if it needs
+ * writing back, first writing out the run if PAGE cannot join it.
+ * Clean pages cost nothing. */
+static bool
+writeback_add (struct page *page, void *wb_) {
+	struct writeback *wb = wb_;
+
+	if (!needs_writeback (page))
+		return true;
+	if (wb->cnt == WRITEBACK_MAX
+			|| (wb->cnt > 0 && !follows (wb->run[wb->cnt - 1], page)))
+		writeback_flush (wb);
+	wb->run[wb->cnt++] = page;
+	return true;
+}
+
+/* Writes back the dirty file pages of SPT in [START, END), with one
+ * write per run of pages that are contiguous both in memory and in
+ * their file.  The caller owns SPT. */
+void
+file_writeback (struct supplemental_page_table *spt, void *start,
+		void *end) {
+	struct writeback wb;
+
+	wb.cnt = 0;
+	lock_acquire (&frame_lock);
+	spt_for_each (spt, start, end, writeback_add, &wb);
+	writeback_flush (&wb);
+	lock_release (&frame_lock);
 }
 
-/* Swap out the page by writeback contents to the file. */
+/* Returns the page at VA in PAGE's address space if it can be
+ * written back along with PAGE.  The caller holds the owner's
+ * supplemental page table lock. */
+static struct page *
+writeback_neighbor (struct page *page, void *va) {
+	struct page *n;
+
+	if (!is_user_vaddr (va))
+		return NULL;
+	n = spt_find_page (&page->owner->spt, va);
+	if (n == NULL || !needs_writeback (n))
+		return NULL;
+	return n;
+}
+
+/* Swap out the page by writeback contents to the file.
+ *
+ * Dirty pages around PAGE that continue it in the file are written
+ * back in the same write and stay resident, clean, so that they can
+ * later be evicted without I/O.  Only PAGE is collected if its
+ * owner's table is busy. */
 static bool
 file_backed_swap_out (struct page *page) {
-	struct file_page *file_page UNUSED = &page->file;
+	struct lock *spt_lock = &page->owner->spt.lock;
+	struct page *below[WRITEBACK_MAX];
+	struct writeback wb;
+	size_t lo = 0, i;
+	struct page *n;
+
+	if (!pml4_is_dirty (page->owner->pml4, page->va))
+		return true;
+
+	wb.cnt = 0;
+	if (lock_try_acquire (spt_lock)) {
+		while (lo + 1 < WRITEBACK_MAX
+				&& (n = writeback_neighbor (page, page->va - (lo + 1) * PGSIZE))
+				&& follows (n, lo > 0 ? below[lo - 1] : page))
+			below[lo++] = n;
+		for (i = 0; i < lo; i++)
+			wb.run[wb.cnt++] = below[lo - 1 - i];
+		wb.run[wb.cnt++] = page;
+		while (wb.cnt < WRITEBACK_MAX
+				&& (n = writeback_neighbor (page,
+						page->va + (wb.cnt - lo) * PGSIZE))
+				&& follows (wb.run[wb.cnt - 1], n))
+			wb.run[wb.cnt++] = n;
+		lock_release (spt_lock);
+	} else
+		wb.run[wb.cnt++] = page;
+
+	return writeback_run (wb.run, wb.cnt);
 }
 
-/* Destory the file backed page. PAGE will be freed by the caller. */
+/* Destory the file backed page. PAGE will be freed by the caller.
+ * Whoever removes file pages writes them back first, with
+ * file_writeback(). */
 static void
 file_backed_destroy (struct page *page) {
-	struct file_page *file_page UNUSED = &page->file;
+	struct file_page *file_page = &page->file;
+
+	vm_free_frame (page);
+	file_close (file_page->file);
+}
+
+/* Returns the frame in the text cache that holds the contents of
+ * PAGE, a file page, or NULL if there is none or PAGE is not text. */
+struct frame *
+file_text_find (struct page *page) {
+	struct text_frame key;
+	struct hash_elem *e;
+
+	ASSERT (lock_held_by_current_thread (&frame_lock));
+	ASSERT (page->operations == &file_ops);
+
+	if (!page->file.text)
+		return NULL;
+	key.inode = file_get_inode (page->file.file);
+	key.ofs = page->file.ofs;
+	key.read_bytes = page->file.read_bytes;
+	e = hash_find (&text_cache, &key.elem);
+	if (e == NULL)
+		return NULL;
+	text_hits++;
+	return hash_entry (e, struct text_frame, elem)->frame;
+}
+
+/* Enters FRAME, which PAGE maps, into the text cache, unless it is
+ * there already or PAGE is not a text page.  Without
+ * memory for the cache entry, FRAME just stays out of the cache. */
+void
+file_text_add (struct frame *frame, struct page *page) {
+	struct text_frame *text;
+
+	ASSERT (lock_held_by_current_thread (&frame_lock));
+
+	if (frame->text != NULL || page->operations != &file_ops
+			|| !page->file.text)
+		return;
+	text = malloc (sizeof *text);
+	if (text == NULL)
+		return;
+	text->inode = file_get_inode (page->file.file);
+	text->ofs = page->file.ofs;
+	text->read_bytes = page->file.read_bytes;
+	text->frame = frame;
+	if (hash_insert (&text_cache, &text->elem) != NULL) {
+		free (text);
+		return;
+	}
+	frame->text = text;
+}
+
+/* Removes FRAME from the text cache, once its last page is gone or
+ * it is being evicted. */
+void
+file_text_drop (struct frame *frame) {
+	ASSERT (lock_held_by_current_thread (&frame_lock));
+
+	hash_delete (&text_cache, &frame->text->elem);
+	free (frame->text);
+	frame->text = NULL;
+}
+
+/* Returns a hash value for text frame E. */
+static uint64_t
+text_hash (const struct hash_elem *e, void *aux UNUSED) {
+	const struct text_frame *t = hash_entry (e, struct text_frame, elem);
+	return hash_bytes (&t->inode, sizeof t->inode) ^ hash_int (t->ofs);
+}
+
+/* Orders text frames A and B by inode, offset and length. */
+static bool
+text_less (const struct hash_elem *a_, const struct hash_elem *b_,
+		void *aux UNUSED) {
+	const struct text_frame *a = hash_entry (a_, struct text_frame, elem);
+	const struct text_frame *b = hash_entry (b_, struct text_frame, elem);
+
+	if (a->inode != b->inode)
+		return a->inode < b->inode;
+	if (a->ofs != b->ofs)
+		return a->ofs < b->ofs;
+	return a->read_bytes < b->read_bytes;
+}
+
+/* Returns the number of pages of the memory mapping that starts at
+ * PAGE, or 0 if no mapping starts there. */
+static size_t
+mapping_page_cnt (struct page *page) {
+	if (VM_TYPE (page->operations->type) == VM_UNINIT)
+		return VM_TYPE (page->uninit.type) == VM_FILE
+			? ((struct lazy_load_arg *) page->uninit.aux)->map_cnt : 0;
+	return page->operations == &file_ops ? page->file.map_cnt : 0;
 }
 
 /* Do the mmap */
 void *
 do_mmap (void *addr, size_t length, int writable,
 		struct file *file, off_t offset) {
+	struct supplemental_page_table *spt = &thread_current ()->spt;
+	off_t file_len = file_length (file);
+	size_t page_cnt, i;
+
+	if (addr == NULL || pg_ofs (addr) != 0 || length == 0
+			|| offset < 0 || offset % PGSIZE != 0 || file_len == 0
+			|| !is_user_vaddr (addr) || !is_user_vaddr (addr + length - 1)
+			|| addr + length < addr)
+		return NULL;
+	page_cnt = DIV_ROUND_UP (length, PGSIZE);
+	for (i = 0; i < page_cnt; i++)
+		if (spt_find_page (spt, addr + i * PGSIZE) != NULL)
+			return NULL;
+
+	for (i = 0; i < page_cnt; i++) {
+		off_t pos = offset + i * PGSIZE;
+		size_t left = length - i * PGSIZE;
+		size_t read_bytes = pos < file_len ? file_len - pos : 0;
+		struct lazy_load_arg *aux = malloc (sizeof *aux);
+
+		if (read_bytes > left)
+			read_bytes = left;
+		if (read_bytes > PGSIZE)
+			read_bytes = PGSIZE;
+		if (aux == NULL)
+			goto fail;
+		aux->file = file_reopen (file);
+		if (aux->file == NULL) {
+			free (aux);
+			goto fail;
+		}
+		aux->ofs = pos;
+		aux->read_bytes = read_bytes;
+		aux->zero_bytes = PGSIZE - read_bytes;
+		aux->map_cnt = i == 0 ? page_cnt : 0;
+		aux->text = false;
+		if (!vm_alloc_page_with_initializer (VM_FILE, addr + i * PGSIZE,
+					writable, NULL, aux)) {
+			lazy_load_arg_free (aux);
+			goto fail;
+		}
+	}
+	return addr;
+
+fail:
+	while (i-- > 0)
+		spt_remove_page (spt, spt_find_page (spt, addr + i * PGSIZE));
+	return NULL;
 }
 
 /* Do the munmap */
 void
 do_munmap (void *addr) {
+	struct supplemental_page_table *spt = &thread_current ()->spt;
+	struct page *page = spt_find_page (spt, addr);
+	size_t page_cnt = page != NULL ? mapping_page_cnt (page) : 0;
+	size_t i;
+
+	if (page_cnt == 0)
+		return;
+	file_writeback (spt, addr, addr + page_cnt * PGSIZE);
+
+	/* Unmap the whole mapping with one TLB flush; the pages' teardown
+	 * then leaves their PTEs alone. */
+	pml4_clear_range (thread_current ()->pml4, addr, page_cnt);
+	for (i = 0; i < page_cnt; i++) {
+		page = spt_find_page (spt, addr + i * PGSIZE);
+		if (page != NULL) {
+			page->unmapped = true;
+			spt_remove_page (spt, page);
+		}
+	}
 }
@@ -0,0 +1,265 @@
+/* ksm.c: Merges anonymous frames that hold the same bytes.
+ *
+ * A kernel thread, ksmd, wakes up every KSM_SLEEP_MS milliseconds
+ * and walks the next KSM_SCAN_PAGES frames of the frame table.  A
+ * private anonymous frame whose checksum has not changed since the
+ * previous pass is looked up by checksum, first among the frames
+ * already merged (the stable table), then among the candidates seen
+ * earlier in this pass (the unstable table).  On a byte-for-byte
+ * match the page is mapped read-only onto the other frame, and its
+ * own frame is freed; a later write to it breaks the sharing through
+ * the copy-on-write path, just like after fork.  Pages of zeros are
+ * merged into the zero page.
+ *
+ * Both tables hold one frame per checksum, keyed by a checksum that
+ * does not change while the frame is in the table.  The unstable
+ * table is emptied at the end of each pass over the frame table.
+ * Everything here is protected by the frame lock.
+ *
+ * Merging is off unless the kernel is given -ksm=PAGES. */
+
+#include "vm/ksm.h"
+#include <hash.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/timer.h"
+#include "threads/mmu.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "vm/vm.h"
+
+size_t ksm_scan_pages;
+unsigned ksm_sleep_ms = 100;
+
+/* Frames ksmd has merged other frames into, and candidates for this
+ * pass.  A frame's ksm_state tells which table, if any, holds it. */
+static struct hash stable;
+static struct hash unstable;
+
+/* Next frame to scan, or the end of the frame table to start a new
+ * pass from the front. */
+static struct list_elem *cursor;
+
+/* Checksum of a page of zeros. */
+static uint64_t zero_sum;
+
+/* Statistics. */
+static long long scan_cnt;      /* Frames looked at. */
+static long long merge_cnt;     /* Pages merged into another frame. */
+static long long zero_cnt;      /* ...of which into the zero page. */
+static long long pass_cnt;      /* Full passes over the frame table. */
+
+static void ksmd (void *aux);
+static uint64_t frame_sum_hash (const struct hash_elem *e, void *aux);
+static bool frame_sum_less (const struct hash_elem *a,
+		const struct hash_elem *b, void *aux);
+
+/* Starts ksmd, if -ksm was given. */
+void
+ksm_init (void) {
+	if (ksm_scan_pages == 0)
+		return;
+	if (!hash_init (&stable, frame_sum_hash, frame_sum_less, NULL)
+			|| !hash_init (&unstable, frame_sum_hash, frame_sum_less, NULL))
+		PANIC ("ksm: out of memory");
+	cursor = list_end (&frame_table);
+	zero_sum = hash_bytes (zero_frame.kva, PGSIZE);
+	thread_create ("ksmd", PRI_DEFAULT, ksmd, NULL);
+}
+
+/* Prints same-page merging statistics. */
+void
+ksm_print_stats (void) {
+	if (ksm_scan_pages == 0)
+		return;
+	printf ("KSM: %lld frames scanned in %lld passes, %lld pages merged "
+			"(%lld into the zero page), %zu shared frames\n",
+			scan_cnt, pass_cnt, merge_cnt, zero_cnt, hash_size (&stable));
+}
+
+/* Takes FRAME out of the stable or unstable table.  Called with the
+ * frame lock held before FRAME's contents may change: when a page
+ * takes over a frame nobody else maps any more. */
+void
+ksm_forget (struct frame *frame) {
+	ASSERT (lock_held_by_current_thread (&frame_lock));
+
+	if (frame->ksm_state == KSM_STABLE)
+		hash_delete (&stable, &frame->ksm_elem);
+	else if (frame->ksm_state == KSM_UNSTABLE)
+		hash_delete (&unstable, &frame->ksm_elem);
+	frame->ksm_state = KSM_NONE;
+}
+
+/* Called with the frame lock held when FRAME leaves the frame
+ * table, to be freed or reused for another page. */
+void
+ksm_frame_removed (struct frame *frame) {
+	if (ksm_scan_pages == 0)
+		return;
+	if (cursor == &frame->elem)
+		cursor = list_next (cursor);
+	ksm_forget (frame);
+}
+
+/* Returns true if FRAME holds an anonymous page that nobody else
+ * maps, and not as part of a huge page. */
+static bool
+frame_is_private (struct frame *frame) {
+	return frame->page != NULL && frame->share_cnt == 1
+		&& frame->huge_pt == NULL
+		&& VM_TYPE (frame->page->operations->type) == VM_ANON;
+}
+
+/* Write-protects FRAME's page, or gives write access back to it if
+ * the page is writable and PROTECT is false.  FRAME is mapped by its
+ * page alone. */
+static void
+protect (struct frame *frame, bool protect) {
+	struct page *page = frame->page;
+
+	pml4_set_writable (page->owner->pml4, page->va,
+			!protect && page->writable);
+}
+
+/* Maps PAGE read-only onto INTO, which holds the same bytes, and
+ * frees the frame PAGE used to have. */
+static void
+merge (struct page *page, struct frame *into) {
+	uint64_t *pml4 = page->owner->pml4;
+	struct frame *old = page->frame;
+	bool dirty = pml4_is_dirty (pml4, page->va);
+
+	pml4_clear_page (pml4, page->va);
+	if (!pml4_set_page (pml4, page->va, into->kva, false)) {
+		/* Only the page tables' own pages are allocated here, and
+		 * the old mapping's are still there. */
+		NOT_REACHED ();
+	}
+	/* Whether a copy of the contents lives in swap stays as it was. */
+	pml4_set_dirty (pml4, page->va, dirty);
+	frame_get (into, page);
+	page->frame = into;
+	frame_put (old, page);
+	merge_cnt++;
+}
+
+/* Tries to merge FRAME into a frame with the same contents, or
+ * remembers it as a candidate for frames scanned later. */
+static void
+scan_frame (struct frame *frame) {
+	uint64_t sum = hash_bytes (frame->kva, PGSIZE);
+	struct hash_elem *e;
+	struct frame *other;
+
+	scan_cnt++;
+
+	/* Leave pages being written to alone. */
+	if (sum != frame->ksm_sum) {
+		frame->ksm_sum = sum;
+		return;
+	}
+
+	if (sum == zero_sum) {
+		protect (frame, true);
+		if (!memcmp (frame->kva, zero_frame.kva, PGSIZE)) {
+			merge (frame->page, &zero_frame);
+			zero_cnt++;
+			return;
+		}
+		protect (frame, false);
+	}
+
+	e = hash_find (&stable, &frame->ksm_elem);
+	if (e != NULL) {
+		other = hash_entry (e, struct frame, ksm_elem);
+		protect (frame, true);
+		if (!memcmp (frame->kva, other->kva, PGSIZE)) {
+			merge (frame->page, other);
+			return;
+		}
+		protect (frame, false);
+		return;
+	}
+
+	e = hash_find (&unstable, &frame->ksm_elem);
+	if (e == NULL) {
+		if (hash_insert (&unstable, &frame->ksm_elem) == NULL)
+			frame->ksm_state = KSM_UNSTABLE;
+		return;
+	}
+
+	/* OTHER may have changed since it was scanned, but once both are
+	 * read-only neither can change under us.  If a fork has shared it
+	 * meanwhile, FRAME takes its place. */
+	other = hash_entry (e, struct frame, ksm_elem);
+	ksm_forget (other);
+	if (!frame_is_private (other)) {
+		if (hash_insert (&unstable, &frame->ksm_elem) == NULL)
+			frame->ksm_state = KSM_UNSTABLE;
+		return;
+	}
+	protect (frame, true);
+	protect (other, true);
+	if (!memcmp (frame->kva, other->kva, PGSIZE)) {
+		other->ksm_sum = sum;
+		if (hash_insert (&stable, &other->ksm_elem) == NULL)
+			other->ksm_state = KSM_STABLE;
+		merge (frame->page, other);
+		return;
+	}
+	protect (frame, false);
+	protect (other, false);
+}
+
+/* Resets the state of FRAME, an element of the unstable table being
+ * cleared. */
+static void
+unstable_clear (struct hash_elem *e, void *aux UNUSED) {
+	hash_entry (e, struct frame, ksm_elem)->ksm_state = KSM_NONE;
+}
+
+/* Scans up to KSM_SCAN_PAGES frames from the cursor on. */
+static void
+scan (void) {
+	size_t i;
+
+	lock_acquire (&frame_lock);
+	for (i = 0; i < ksm_scan_pages && !list_empty (&frame_table); i++) {
+		struct frame *frame;
+
+		if (cursor == list_end (&frame_table)) {
+			hash_clear (&unstable, unstable_clear);
+			cursor = list_begin (&frame_table);
+			pass_cnt++;
+		}
+		frame = list_entry (cursor, struct frame, elem);
+		cursor = list_next (cursor);
+		if (frame->ksm_state == KSM_NONE && frame_is_private (frame))
+			scan_frame (frame);
+	}
+	lock_release (&frame_lock);
+}
+
+/* ksmd's thread function. */
+static void
+ksmd (void *aux UNUSED) {
+	for (;;) {
+		timer_msleep (ksm_sleep_ms);
+		scan ();
+	}
+}
+
+/* Returns the checksum of frame E as its hash value. */
+static uint64_t
+frame_sum_hash (const struct hash_elem *e, void *aux UNUSED) {
+	return hash_entry (e, struct frame, ksm_elem)->ksm_sum;
+}
+
+/* Orders frames A and B by checksum. */
+static bool
+frame_sum_less (const struct hash_elem *a, const struct hash_elem *b,
+		void *aux UNUSED) {
+	return hash_entry (a, struct frame, ksm_elem)->ksm_sum
+		< hash_entry (b, struct frame, ksm_elem)->ksm_sum;
+}
@@ -10,6 +10,8 @@
 
 #include "vm/vm.h"
 #include "vm/uninit.h"
+#include "filesys/file.h"
+#include "threads/malloc.h"
 
 static bool uninit_initialize (struct page *page, void *kva);
 static void uninit_destroy (struct page *page);
@@ -42,6 +44,17 @@ uninit_new (struct page *page, void *va, vm_initializer *init,
 	};
 }
 
+/* An anonymous page that loads from a file keeps INIT and its load
+ * information AUX once initialized, to load again after
+ * MADV_DONTNEED; INIT leaves AUX alone. */
+static void
+keep_load (struct page *page, vm_initializer *init, void *aux) {
+	if (init != NULL && page->operations->type == VM_ANON) {
+		page->anon.init = init;
+		page->anon.load = aux;
+	}
+}
+
 /* Initalize the page on first fault */
 static bool
 uninit_initialize (struct page *page, void *kva) {
@@ -52,8 +65,28 @@ uninit_initialize (struct page *page, void *kva) {
 	void *aux = uninit->aux;
 
 	/* TODO: You may need to fix this function. */
-	return uninit->page_initializer (page, uninit->type, kva) &&
-		(init ? init (page, aux) : true);
+	if (!uninit->page_initializer (page, uninit->type, kva))
+		return false;
+	keep_load (page, init, aux);
+	return init ? init (page, aux) : true;
+}
+
+/* Initializes PAGE, which loads from a file, as its first fault
+ * would, except that its contents are in KVA already: read together
+ * with its neighbors' by fault-around. */
+bool
+uninit_preloaded (struct page *page, void *kva) {
+	struct uninit_page *uninit = &page->uninit;
+	vm_initializer *init = uninit->init;
+	void *aux = uninit->aux;
+
+	/* A file page's initializer reads only if given a frame. */
+	if (init == NULL)
+		return uninit->page_initializer (page, uninit->type, NULL);
+	if (!uninit->page_initializer (page, uninit->type, kva))
+		return false;
+	keep_load (page, init, aux);
+	return true;
 }
 
 /* Free the resources hold by uninit_page. Although most of pages are transmuted
@@ -62,7 +95,37 @@ uninit_initialize (struct page *page, void *kva) {
  * PAGE will be freed by the caller. */
 static void
 uninit_destroy (struct page *page) {
-	struct uninit_page *uninit UNUSED = &page->uninit;
-	/* TODO: Fill this function.
-	 * TODO: If you don't have anything to do, just return. */
+	struct uninit_page *uninit = &page->uninit;
+
+	/* The only AUX handed to vm_alloc_page_with_initializer() is the
+	 * load information of lazily loaded segments. */
+	if (uninit->aux != NULL)
+		lazy_load_arg_free (uninit->aux);
+}
+
+/* Returns a copy of ARG with its own reopened file, for a forked
+ * child's copy of a page that is not loaded yet, or NULL if memory
+ * runs out. */
+struct lazy_load_arg *
+lazy_load_arg_dup (const struct lazy_load_arg *arg) {
+	struct lazy_load_arg *copy = malloc (sizeof *copy);
+
+	if (copy == NULL)
+		return NULL;
+	*copy = *arg;
+	copy->file = file_reopen (arg->file);
+	if (copy->file == NULL) {
+		free (copy);
+		return NULL;
+	}
+	if (copy->text)
+		file_deny_write (copy->file);
+	return copy;
+}
+
+/* Closes ARG's file and frees ARG. */
+void
+lazy_load_arg_free (struct lazy_load_arg *arg) {
+	file_close (arg->file);
+	free (arg);
 }
@@ -1,8 +1,152 @@
 /* vm.c: Generic interface for virtual memory objects. */
 
+#include <stdio.h>
+#include <string.h>
+#include <vmstat.h>
+#include "devices/timer.h"
 #include "threads/malloc.h"
+#include "threads/mmu.h"
+#include "threads/pte.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+#include "intrinsic.h"
 #include "vm/vm.h"
 #include "vm/inspect.h"
+#include "vm/ksm.h"
+#include "vm/compact.h"
+
+/* Pages the user stack may grow to, set by -stack-limit. */
+size_t stack_limit = 256;
+
+/* Bounds of the stack growth window: the number of pages below a
+ * growth fault that are mapped along with it.  See
+ * vm_stack_growth(). */
+#define STACK_GROW_MIN 1
+#define STACK_GROW_MAX 32
+
+/* Growth faults at most this many timer ticks apart count as the
+ * stack growing quickly. */
+#define STACK_GROW_TICKS 1
+
+/* Unmapped pages the stack keeps between itself and any other
+ * mapping below it. */
+#define STACK_GUARD 16
+
+/* Most pages read in around a page that comes back from swap. */
+#define READAHEAD_MAX 7
+
+/* Bounds of the fault-around window: the number of pages after a
+ * faulting page that is loaded from a file which are loaded along
+ * with it.  See fault_around(). */
+#define FAULT_AROUND_MIN 1
+#define FAULT_AROUND_MAX 16
+
+/* Every frame holding a user page, in the order the clock hand
+ * visits them.  CLOCK_HAND is the next frame to consider for
+ * eviction, or the list end to start over from the front.
+ * FRAME_CNT counts them, since list_size() walks the list. */
+struct list frame_table;
+static struct list_elem *clock_hand;
+static size_t frame_cnt;
+
+/* Serializes the frame table and everything that moves pages into
+ * or out of frames: claiming, eviction and copy-on-write, including
+ * the I/O they do, along with the frames' rmaps and the frame/page
+ * links. */
+struct lock frame_lock;
+
+/* Free user frame watermarks for kswapd: it wakes up when fewer
+ * than KSWAPD_LOW frames are free and evicts until KSWAPD_HIGH are.
+ * Zero, the default, leaves kswapd out. */
+size_t kswapd_low;
+size_t kswapd_high;
+
+/* Frames kswapd evicts per hold of FRAME_LOCK. */
+#define KSWAPD_BATCH 8
+
+static struct semaphore kswapd_sema;
+static bool kswapd_awake;
+static void kswapd_init (void);
+
+/* Transparent huge pages.  A write fault in a 2 MB-aligned range of
+ * untouched anonymous memory maps the whole range with one 2 MB
+ * page from an aligned run of 512 frames, when every page of the
+ * range is an untouched, writable anonymous page.  Each of the 512
+ * frames still has its struct frame and page, so the rest of the
+ * VM sees small pages; whatever must unmap, protect or evict one of
+ * them alone splits the range back into 4 kB pages first.  Off
+ * unless -thp is given. */
+bool thp_enabled;
+#define HUGE_PAGE_CNT (PGSIZE_2M / PGSIZE)
+
+/* Eviction statistics. */
+static long long evict_cnt;     /* Frames evicted. */
+static long long evict_clean;   /* ...of which were clean. */
+static long long clock_steps;   /* Frames the clock hand passed over. */
+static long long dead_drops;    /* Dead processes' pages unmapped unwritten. */
+static long long readahead_cnt; /* Pages brought in by swap readahead. */
+static long long faultaround_cnt; /* Pages loaded by fault-around... */
+static long long readaround_reads; /* ...with this many batched reads. */
+static long long stack_grows;     /* Stack growth faults... */
+static long long stack_pages;     /* ...and the pages they mapped. */
+static long long zero_maps;     /* Read faults served by the zero page. */
+static long long kswapd_wakeups;  /* Times kswapd was woken. */
+static long long kswapd_cnt;      /* Frames kswapd freed. */
+static long long huge_cnt;        /* Huge pages mapped... */
+static long long huge_splits;     /* ...and split up again. */
+
+/* Fault statistics, reported by vm_vmstat(): faults handled by kind,
+ * faults that were not, the largest the frame table has been, and a
+ * log2 histogram of the cycles vm_try_handle_fault() took. */
+static long long fault_cnt[VMSTAT_FAULT_CNT];
+static long long bad_fault_cnt;
+static size_t frames_peak;
+static long long fault_cycles[VMSTAT_HIST_CNT];
+
+static const char *fault_names[VMSTAT_FAULT_CNT] = {
+	"uninit", "anon", "file", "swap-in", "stack", "wp",
+};
+static void print_fault_stats (void);
+
+/* A frame of zeros that read faults on untouched anonymous pages map
+ * read-only in place of a frame of their own; the first write gives
+ * the page its own frame (see vm_handle_wp()).  It is never in the
+ * frame table, and the reference vm_init() holds keeps share_cnt
+ * above one, so it is never evicted, taken over or freed. */
+struct frame zero_frame;
+
+/* Supplemental page table: a radix tree indexed by virtual page
+ * number: SPT_LEVELS levels of SPT_FANOUT slots, each level taking
+ * SPT_BITS bits of the address, which covers all of user space
+ * (below KERN_BASE, under 2^40).  The slots of the last level point
+ * to pages, the others to the nodes below.  Nodes are made on
+ * demand with calloc() and freed once they are empty.
+ *
+ * Nodes of a whole kernel page, 512 slots as in the x86-64 page
+ * tables, would save a level per lookup, but most processes map a
+ * few small regions far apart, and each region would hold a kernel
+ * page per level mostly empty.  512-byte nodes cost a fifth level
+ * and keep a small process's table to a few kilobytes. */
+#define SPT_BITS 6
+#define SPT_FANOUT (1 << SPT_BITS)
+#define SPT_LEVELS 5
+#define SPT_LIMIT (1ULL << (PGBITS + SPT_LEVELS * SPT_BITS))
+
+struct spt_node {
+	void *slots[SPT_FANOUT];
+};
+
+/* Shift of the address bits that index each level. */
+static const unsigned spt_shift[SPT_LEVELS] = {
+	PGBITS + 4 * SPT_BITS, PGBITS + 3 * SPT_BITS, PGBITS + 2 * SPT_BITS,
+	PGBITS + SPT_BITS, PGBITS,
+};
+
+/* Returns the slot of VA in LEVEL of the tree. */
+static inline size_t
+spt_index (const void *va, int level) {
+	return ((uint64_t) va >> spt_shift[level]) & (SPT_FANOUT - 1);
+}
 
 /* Initializes the virtual memory subsystem by invoking each subsystem's
  * intialize codes. */
@@ -15,7 +159,109 @@ vm_init (void) {
 #endif
 	register_inspect_intr ();
 	/* DO NOT MODIFY UPPER LINES. */
-	/* TODO: Your code goes here. */
+	list_init (&frame_table);
+	clock_hand = list_end (&frame_table);
+	lock_init (&frame_lock);
+	zero_frame.kva = palloc_get_page (PAL_ASSERT | PAL_ZERO);
+	zero_frame.share_cnt = 1;
+	list_init (&zero_frame.rmap);
+	ksm_init ();
+	kswapd_init ();
+	compact_init ();
+}
+
+/* Prints eviction statistics. */
+void
+vm_print_stats (void) {
+	printf ("Eviction: %lld frames (%lld clean), %lld clock steps, "
+			"%lld dead pages dropped\n",
+			evict_cnt, evict_clean, clock_steps, dead_drops);
+	printf ("Readahead: %lld pages, fault-around: %lld pages in %lld reads\n",
+			readahead_cnt, faultaround_cnt, readaround_reads);
+	printf ("Zero page: %lld read faults\n", zero_maps);
+	printf ("Stack growth: %lld faults, %lld pages\n",
+			stack_grows, stack_pages);
+	print_fault_stats ();
+	if (kswapd_low > 0)
+		printf ("kswapd: %lld wakeups, %lld frames freed\n",
+				kswapd_wakeups, kswapd_cnt);
+	if (thp_enabled)
+		printf ("Huge pages: %lld mapped, %lld split\n", huge_cnt, huge_splits);
+	ksm_print_stats ();
+	compact_print_stats ();
+	anon_print_stats ();
+	file_print_stats ();
+}
+
+/* Prints fault counts and, if any fault was handled, the latency
+ * histogram from its first to its last nonzero bucket. */
+static void
+print_fault_stats (void) {
+	int first = -1, last = -1;
+	int i;
+
+	printf ("Faults:");
+	for (i = 0; i < VMSTAT_FAULT_CNT; i++)
+		printf (" %lld %s,", fault_cnt[i], fault_names[i]);
+	printf (" %lld bad\n", bad_fault_cnt);
+	printf ("Frame table: %zu frames, %zu at most\n",
+			frame_cnt, frames_peak);
+
+	for (i = 0; i < VMSTAT_HIST_CNT; i++)
+		if (fault_cycles[i] > 0) {
+			if (first < 0)
+				first = i;
+			last = i;
+		}
+	if (first < 0)
+		return;
+	printf ("Fault latency (cycles):\n");
+	for (i = first; i <= last; i++)
+		printf ("  >= 2^%-2d %lld\n", i, fault_cycles[i]);
+}
+
+/* Copies the VM statistics to BUF, a struct vmstat in the current
+ * process's memory.  Returns false if BUF is not in writable user
+ * memory. */
+bool
+vm_vmstat (void *buf) {
+	struct supplemental_page_table *spt = &thread_current ()->spt;
+	struct vmstat st;
+	void *va;
+	int i;
+
+	if (buf == NULL || buf + sizeof st < buf || !is_user_vaddr (buf)
+			|| !is_user_vaddr (buf + sizeof st - 1))
+		return false;
+	for (va = pg_round_down (buf); va < buf + sizeof st; va += PGSIZE) {
+		struct page *page = spt_find_page (spt, va);
+
+		if (page == NULL || !page->writable)
+			return false;
+	}
+
+	memset (&st, 0, sizeof st);
+	memcpy (st.faults, fault_cnt, sizeof st.faults);
+	st.bad_faults = bad_fault_cnt;
+	st.evictions = evict_cnt;
+	anon_vmstat (&st);
+	file_vmstat (&st);
+	lock_acquire (&frame_lock);
+	st.frames = frame_cnt;
+	st.frames_peak = frames_peak;
+	lock_release (&frame_lock);
+	for (i = 0; i < 2; i++) {
+		struct palloc_stats pool;
+
+		palloc_get_stats (i == 0 ? 0 : PAL_USER, &pool);
+		st.pool_free[i] = pool.free_cnt;
+		st.pool_borrowed[i] = pool.borrowed_cnt;
+		st.pool_empty[i] = pool.empty_cnt;
+	}
+	memcpy (st.latency, fault_cycles, sizeof st.latency);
+
+	memcpy (buf, &st, sizeof st);
+	return true;
 }
 
 /* Get the type of the page. This function is useful if you want to know the
@@ -35,7 +281,18 @@ page_get_type (struct page *page) {
 /* Helpers */
 static struct frame *vm_get_victim (void);
 static bool vm_do_claim_page (struct page *page);
+static bool claim_locked (struct page *page);
+static bool claim_zero_page (struct page *page);
+static bool claim_shared (struct page *page);
+static void deactivate_behind (struct page *page);
+static bool stack_add_page (void *va);
+static bool claim_readahead (struct page *page, const void *data);
+static bool page_starts_zeroed (struct page *page);
+static bool claim_huge (struct page *page);
+static void split_huge (struct page *page);
 static struct frame *vm_evict_frame (void);
+static void rmap_remove (struct frame *frame, struct page *page);
+static void kswapd_check (void);
 
 /* Create the pending page object with initializer. If you want to create a
  * page, do not create it directly and make it through this function or
@@ -48,96 +305,724 @@ vm_alloc_page_with_initializer (enum vm_type type, void *upage, bool writable,
 
 	struct supplemental_page_table *spt = &thread_current ()->spt;
 
+	ASSERT (pg_ofs (upage) == 0);
+
 	/* Check wheter the upage is already occupied or not. */
 	if (spt_find_page (spt, upage) == NULL) {
-		/* TODO: Create the page, fetch the initialier according to the VM type,
-		 * TODO: and then create "uninit" page struct by calling uninit_new. You
-		 * TODO: should modify the field after calling the uninit_new. */
+		bool (*initializer) (struct page *, enum vm_type, void *);
+		struct page *page;
+
+		switch (VM_TYPE (type)) {
+			case VM_ANON:
+				initializer = anon_initializer;
+				break;
+			case VM_FILE:
+				initializer = file_backed_initializer;
+				break;
+			default:
+				goto err;
+		}
+
+		page = malloc (sizeof *page);
+		if (page == NULL)
+			goto err;
+		uninit_new (page, upage, init, type, aux, initializer);
+		page->owner = thread_current ();
+		page->writable = writable;
+		page->advice = MADV_NORMAL;
 
-		/* TODO: Insert the page into the spt. */
+		if (!spt_insert_page (spt, page)) {
+			free (page);
+			goto err;
+		}
+		return true;
 	}
 err:
 	return false;
 }
 
+/* Returns the leaf slot for VA in SPT.  If CREATE is true, makes
+ * the missing nodes on the way, returning NULL if memory runs out;
+ * otherwise returns NULL if there is no slot for VA yet. */
+static void **
+spt_slot (struct supplemental_page_table *spt, const void *va, bool create) {
+	void **slot = &spt->root;
+	int level;
+
+	if ((uint64_t) va >= SPT_LIMIT)
+		return NULL;
+	for (level = 0; level < SPT_LEVELS; level++) {
+		struct spt_node *node = *slot;
+
+		if (node == NULL) {
+			if (!create || (node = calloc (1, sizeof *node)) == NULL)
+				return NULL;
+			*slot = node;
+		}
+		slot = &node->slots[spt_index (va, level)];
+	}
+	return slot;
+}
+
+/* Returns true if no slot of NODE is in use. */
+static bool
+spt_node_is_empty (const struct spt_node *node) {
+	size_t i;
+
+	for (i = 0; i < SPT_FANOUT; i++)
+		if (node->slots[i] != NULL)
+			return false;
+	return true;
+}
+
 /* Find VA from spt and return page. On error, return NULL. */
 struct page *
-spt_find_page (struct supplemental_page_table *spt UNUSED, void *va UNUSED) {
-	struct page *page = NULL;
-	/* TODO: Fill this function. */
+spt_find_page (struct supplemental_page_table *spt, void *va) {
+	void **slot = spt_slot (spt, va, false);
 
-	return page;
+	return slot != NULL ? *slot : NULL;
 }
 
 /* Insert PAGE into spt with validation. */
 bool
-spt_insert_page (struct supplemental_page_table *spt UNUSED,
-		struct page *page UNUSED) {
-	int succ = false;
-	/* TODO: Fill this function. */
+spt_insert_page (struct supplemental_page_table *spt, struct page *page) {
+	void **slot;
+	bool success = false;
 
-	return succ;
+	lock_acquire (&spt->lock);
+	slot = spt_slot (spt, page->va, true);
+	if (slot != NULL && *slot == NULL) {
+		*slot = page;
+		success = true;
+	}
+	lock_release (&spt->lock);
+	return success;
 }
 
 void
 spt_remove_page (struct supplemental_page_table *spt, struct page *page) {
+	void **path[SPT_LEVELS];
+	void **slot = &spt->root;
+	int level;
+
+	lock_acquire (&spt->lock);
+	for (level = 0; level < SPT_LEVELS; level++) {
+		struct spt_node *node = *slot;
+
+		ASSERT (node != NULL);
+		path[level] = slot;
+		slot = &node->slots[spt_index (page->va, level)];
+	}
+	ASSERT (*slot == page);
+	*slot = NULL;
+
+	/* Free the nodes this leaves empty, from the bottom up. */
+	for (level = SPT_LEVELS - 1; level >= 0; level--) {
+		struct spt_node *node = *path[level];
+
+		if (!spt_node_is_empty (node))
+			break;
+		free (node);
+		*path[level] = NULL;
+	}
+	lock_release (&spt->lock);
 	vm_dealloc_page (page);
+}
+
+/* Calls ACTION for each page in NODE, a node at LEVEL whose first
+ * slot covers address BASE, that lies in [START, END), in address
+ * order.  Stops and returns false as soon as ACTION does. */
+static bool
+spt_walk (struct spt_node *node, int level, uint64_t base,
+		uint64_t start, uint64_t end, spt_action_func *action, void *aux) {
+	uint64_t span = 1UL << spt_shift[level];
+	size_t i = start > base ? (start - base) / span : 0;
+
+	for (; i < SPT_FANOUT && base + i * span < end; i++) {
+		void *slot = node->slots[i];
+
+		if (slot == NULL)
+			continue;
+		if (level == SPT_LEVELS - 1) {
+			if (!action (slot, aux))
+				return false;
+		} else if (!spt_walk (slot, level + 1, base + i * span, start, end,
+					action, aux))
+			return false;
+	}
 	return true;
 }
 
-/* Get the struct frame, that will be evicted. */
+/* Calls ACTION with AUX for each page of SPT in [START, END), in
+ * address order, skipping the parts of the range nothing is mapped
+ * in.  ACTION must not add pages to or remove pages from SPT.
+ * Returns false if ACTION returned false, stopping the walk. */
+bool
+spt_for_each (struct supplemental_page_table *spt, void *start, void *end,
+		spt_action_func *action, void *aux) {
+	if (spt->root == NULL || start >= end)
+		return true;
+	return spt_walk (spt->root, 0, 0, (uint64_t) start, (uint64_t) end,
+			action, aux);
+}
+
+/* Adds FRAME to the frame table just behind the clock hand, so
+ * that it is the last frame the hand comes back to. */
+static void
+frame_table_insert (struct frame *frame) {
+	ASSERT (lock_held_by_current_thread (&frame_lock));
+	list_insert (clock_hand, &frame->elem);
+	if (++frame_cnt > frames_peak)
+		frames_peak = frame_cnt;
+}
+
+/* Removes FRAME from the frame table, moving the clock hand off it
+ * first if need be. */
+static void
+frame_table_remove (struct frame *frame) {
+	ASSERT (lock_held_by_current_thread (&frame_lock));
+	if (clock_hand == &frame->elem)
+		clock_hand = list_next (clock_hand);
+	ksm_frame_removed (frame);
+	list_remove (&frame->elem);
+	frame_cnt--;
+}
+
+/* Returns the frame under the clock hand and advances the hand,
+ * wrapping around at the end of the frame table. */
+static struct frame *
+clock_advance (void) {
+	struct frame *frame;
+
+	if (clock_hand == list_end (&frame_table))
+		clock_hand = list_begin (&frame_table);
+	frame = list_entry (clock_hand, struct frame, elem);
+	clock_hand = list_next (clock_hand);
+	clock_steps++;
+	return frame;
+}
+
+/* Returns true if PAGE belongs to a process that has exited and
+ * waits for the reaper to free its address space.  Nobody will read
+ * its contents again: mapped files were written back at exit. */
+static bool
+page_is_dead (struct page *page) {
+	return page->owner->status == THREAD_DYING;
+}
+
+/* Returns true if FRAME may be evicted, which takes some page
+ * mapping it and no pin. */
+static bool
+frame_is_evictable (struct frame *frame) {
+	return !list_empty (&frame->rmap) && !frame->pinned;
+}
+
+/* Returns true if any page mapping FRAME accessed it since the last
+ * call, and clears all their accessed bits. */
+static bool
+frame_test_accessed (struct frame *frame) {
+	struct list_elem *e;
+	bool accessed = false;
+
+	for (e = list_begin (&frame->rmap); e != list_end (&frame->rmap);
+			e = list_next (e)) {
+		struct page *page = list_entry (e, struct page, rmap_elem);
+
+		if (pml4_is_accessed (page->owner->pml4, page->va)) {
+			pml4_set_accessed (page->owner->pml4, page->va, false);
+			accessed = true;
+		}
+	}
+	return accessed;
+}
+
+/* Returns true if FRAME, an evictable frame, must be written out
+ * before it can be reused: some live page mapping it wrote to it. */
+static bool
+frame_is_dirty (struct frame *frame) {
+	struct list_elem *e;
+
+	if (frame->text != NULL)
+		return false;
+	for (e = list_begin (&frame->rmap); e != list_end (&frame->rmap);
+			e = list_next (e)) {
+		struct page *page = list_entry (e, struct page, rmap_elem);
+
+		if (!page_is_dead (page) && pml4_is_dirty (page->owner->pml4, page->va))
+			return true;
+	}
+	return false;
+}
+
+/* Get the struct frame, that will be evicted.
+ *
+ * Second chance: the clock hand sweeps the frame table, clearing
+ * the accessed bit of frames used since its last visit and passing
+ * them over.  The first frame found neither accessed nor dirty is
+ * taken, since evicting it costs no write.  Failing that, after a
+ * full sweep the first unaccessed dirty frame is taken; by then
+ * every accessed bit has been cleared, so the second sweep always
+ * ends with some victim if any frame is evictable at all.
+ *
+ * Frames of huge pages are passed over in the first sweep.  In the
+ * second, a huge page is split and the frame under the hand is
+ * taken as if unaccessed; the others are judged one by one from
+ * then on. */
 static struct frame *
 vm_get_victim (void) {
-	struct frame *victim = NULL;
-	 /* TODO: The policy for eviction is up to you. */
+	struct frame *dirty = NULL;
+	size_t sweep = frame_cnt;
+	size_t i;
 
-	return victim;
+	ASSERT (lock_held_by_current_thread (&frame_lock));
+
+	for (i = 0; i < 2 * sweep; i++) {
+		struct frame *frame = clock_advance ();
+
+		if (!frame_is_evictable (frame))
+			continue;
+		if (frame->huge_pt != NULL) {
+			if (i < sweep)
+				continue;
+			split_huge (frame->page);
+		} else if (frame_test_accessed (frame))
+			continue;
+		if (!frame_is_dirty (frame))
+			return frame;
+		if (dirty == NULL)
+			dirty = frame;
+		if (i + 1 >= sweep)
+			break;
+	}
+	return dirty;
 }
 
 /* Evict one page and return the corresponding frame.
- * Return NULL on error.*/
+ * Return NULL on error.
+ *
+ * Every page mapping the frame is unmapped and swapped out in turn,
+ * each keeping its own copy, as if it had had the frame to itself.
+ * Should one fail, the pages done so far stay out and the frame
+ * stays with the rest.  Pages of dead processes are just unmapped:
+ * writing them out would only be for the reaper to throw away. */
 static struct frame *
 vm_evict_frame (void) {
-	struct frame *victim UNUSED = vm_get_victim ();
-	/* TODO: swap out the victim and return the evicted frame. */
+	struct frame *victim = vm_get_victim ();
+	bool clean;
+
+	if (victim == NULL)
+		return NULL;
+	clean = !frame_is_dirty (victim);
+	while (!list_empty (&victim->rmap)) {
+		struct page *page = list_entry (list_front (&victim->rmap),
+				struct page, rmap_elem);
+		uint64_t *pml4 = page->owner->pml4;
+		bool dirty = pml4_is_dirty (pml4, page->va);
+		bool writable = is_writable (pml4e_walk (pml4, (uint64_t) page->va, 0));
+
+		/* Unmap first, so that the owner cannot change the page while
+		 * it is being written out.  The dirty bit stays in the PTE
+		 * for swap_out() to see. */
+		pml4_clear_page (pml4, page->va);
+		if (page_is_dead (page))
+			dead_drops++;
+		else if (!swap_out (page)) {
+			pml4_set_page (pml4, page->va, victim->kva, writable);
+			pml4_set_dirty (pml4, page->va, dirty);
+			return NULL;
+		}
+		page->frame = NULL;
+		rmap_remove (victim, page);
+	}
 
-	return NULL;
+	evict_cnt++;
+	if (clean)
+		evict_clean++;
+	if (victim->text != NULL)
+		file_text_drop (victim);
+	frame_table_remove (victim);
+	return victim;
 }
 
 /* palloc() and get frame. If there is no available page, evict the page
- * and return it. This always return valid address. That is, if the user pool
- * memory is full, this function evicts the frame to get the available memory
- * space.*/
+ * and return it. That is, if the user pool memory is full, this function
+ * evicts the frame to get the available memory space.  If ZERO is true,
+ * the frame comes back filled with zeros (possibly one the idle thread
+ * has already cleared).  Returns NULL only if no frame can be had at
+ * all.  The frame is not in the frame table yet. */
 static struct frame *
-vm_get_frame (void) {
+vm_get_frame (bool zero) {
 	struct frame *frame = NULL;
-	/* TODO: Fill this function. */
+	void *kva;
+
+	ASSERT (lock_held_by_current_thread (&frame_lock));
 
-	ASSERT (frame != NULL);
-	ASSERT (frame->page == NULL);
+	kva = palloc_get_page (PAL_USER | (zero ? PAL_ZERO : 0));
+	if (kva != NULL) {
+		frame = malloc (sizeof *frame);
+		if (frame == NULL) {
+			palloc_free_page (kva);
+			return NULL;
+		}
+		frame->kva = kva;
+		frame->page = NULL;
+		list_init (&frame->rmap);
+		frame->ksm_state = KSM_NONE;
+		frame->text = NULL;
+		frame->huge_pt = NULL;
+		frame->pinned = false;
+	} else {
+		frame = vm_evict_frame ();
+		if (frame == NULL)
+			return NULL;
+		if (zero)
+			memset (frame->kva, 0, PGSIZE);
+	}
+	frame->share_cnt = 0;
+	kswapd_check ();
+
+	ASSERT (frame->page == NULL && list_empty (&frame->rmap));
 	return frame;
 }
 
-/* Growing the stack. */
+/* Wakes kswapd if free user frames have dropped below the low
+ * watermark. */
+static void
+kswapd_check (void) {
+	if (kswapd_low == 0 || kswapd_awake
+			|| palloc_user_free_cnt () >= kswapd_low)
+		return;
+	kswapd_awake = true;
+	kswapd_wakeups++;
+	sema_up (&kswapd_sema);
+}
+
+/* kswapd: evicts frames in the background, once woken, until the
+ * high watermark of free frames is reached, so that faults find a
+ * free frame instead of evicting one themselves.  It takes
+ * FRAME_LOCK for KSWAPD_BATCH evictions at a time; anonymous
+ * victims take their dirty neighbors to swap along with them (see
+ * anon.c), so the writes go out in clusters. */
+static void
+kswapd (void *aux UNUSED) {
+	for (;;) {
+		sema_down (&kswapd_sema);
+		while (palloc_user_free_cnt () < kswapd_high) {
+			struct frame *frame = NULL;
+			size_t i;
+
+			lock_acquire (&frame_lock);
+			for (i = 0; i < KSWAPD_BATCH; i++) {
+				frame = vm_evict_frame ();
+				if (frame == NULL)
+					break;
+				palloc_free_page (frame->kva);
+				free (frame);
+				kswapd_cnt++;
+			}
+			lock_release (&frame_lock);
+
+			/* Nothing left to evict: wait for the next wakeup. */
+			if (frame == NULL)
+				break;
+		}
+		kswapd_awake = false;
+	}
+}
+
+/* Starts kswapd, if -kswapd-low was given.  The high watermark
+ * defaults to twice the low one. */
 static void
-vm_stack_growth (void *addr UNUSED) {
+kswapd_init (void) {
+	if (kswapd_low == 0)
+		return;
+	if (kswapd_high <= kswapd_low)
+		kswapd_high = 2 * kswapd_low;
+	sema_init (&kswapd_sema, 0);
+	thread_create ("kswapd", PRI_DEFAULT, kswapd, NULL);
+}
+
+/* Reverse mapping.  Each frame lists the pages that map it in its
+ * RMAP, linked through their RMAP_ELEM, and counts them in
+ * SHARE_CNT, so that whatever must unmap a frame, or look at the
+ * accessed and dirty bits of its mappings, finds them all: the
+ * parent and children sharing it after fork, the pages merged into
+ * it, the processes running the same code.  The zero page keeps one
+ * count more than it has pages. */
+
+/* Records that PAGE maps FRAME.  FRAME_LOCK must be held. */
+void
+frame_get (struct frame *frame, struct page *page) {
+	ASSERT (lock_held_by_current_thread (&frame_lock));
+
+	list_push_back (&frame->rmap, &page->rmap_elem);
+	frame->share_cnt++;
+	if (frame->page == NULL)
+		frame->page = page;
+}
+
+/* Takes PAGE out of FRAME's rmap, leaving FRAME itself alone. */
+static void
+rmap_remove (struct frame *frame, struct page *page) {
+	list_remove (&page->rmap_elem);
+	frame->share_cnt--;
+	if (frame->page == page)
+		frame->page = list_empty (&frame->rmap) ? NULL
+			: list_entry (list_front (&frame->rmap), struct page, rmap_elem);
+}
+
+/* Drops PAGE's reference to FRAME, freeing the frame once nobody
+ * maps it any more.  FRAME_LOCK must be held. */
+void
+frame_put (struct frame *frame, struct page *page) {
+	ASSERT (lock_held_by_current_thread (&frame_lock));
+	ASSERT (frame->share_cnt > 0);
+
+	rmap_remove (frame, page);
+	if (frame->share_cnt == 0) {
+		if (frame->text != NULL)
+			file_text_drop (frame);
+		frame_table_remove (frame);
+		palloc_free_page (frame->kva);
+		free (frame);
+	}
+}
+
+/* Unmaps PAGE and releases its frame, if it has one.  Page types'
+ * destroy functions call this once they are done with the
+ * contents.  Clearing the PTE also keeps pml4_destroy() from
+ * freeing the frame a second time; it is left alone if the caller
+ * cleared it along with its neighbors' and set PAGE->UNMAPPED. */
+void
+vm_free_frame (struct page *page) {
+	struct frame *frame;
+
+	lock_acquire (&frame_lock);
+	frame = page->frame;
+	if (frame == NULL) {
+		lock_release (&frame_lock);
+		return;
+	}
+	split_huge (page);
+	if (page->owner->pml4 != NULL && !page->unmapped)
+		pml4_clear_page (page->owner->pml4, page->va);
+	page->frame = NULL;
+	frame_put (frame, page);
+	lock_release (&frame_lock);
+}
+
+/* Returns true if a fault at ADDR with the user stack pointer at
+ * RSP looks like the stack growing: at most 8 bytes below RSP
+ * (PUSH faults before it moves RSP) and within stack_limit pages of
+ * the top of the stack. */
+static bool
+is_stack_access (void *addr, void *rsp) {
+	return (uint8_t *) addr >= (uint8_t *) rsp - 8
+		&& (uint8_t *) addr < (uint8_t *) USER_STACK
+		&& (uint8_t *) addr >= (uint8_t *) USER_STACK - stack_limit * PGSIZE;
+}
+
+/* Growing the stack down to ADDR.  Adds the page of ADDR, which the
+ * fault that found it missing claims like any other, and every page
+ * between it and the bottom of the stack, so that the stack stays
+ * in one piece.  The pages of that gap are below RSP, in the frame
+ * that skipped over them, and a window of pages below ADDR is likely
+ * to be next, so they are brought in now, but only into free frames
+ * (see claim_readahead()).
+ *
+ * The window adapts to the owner's growth: it doubles, up to
+ * STACK_GROW_MAX, when growth faults come less than
+ * STACK_GROW_TICKS apart, and halves, down to STACK_GROW_MIN,
+ * otherwise; it is never smaller than the gap just skipped, as the
+ * next frame is likely to be as large.  The stack never comes
+ * within STACK_GUARD pages of another mapping: a fault that would
+ * is not growth, and the window stops short of it. */
+static bool
+vm_stack_growth (void *addr) {
+	struct supplemental_page_table *spt = &thread_current ()->spt;
+	uint8_t *fault_pg = pg_round_down (addr);
+	uint8_t *limit = (uint8_t *) USER_STACK - stack_limit * PGSIZE;
+	uint8_t *bottom = spt->stack_bottom;
+	uint8_t *va;
+	size_t gap = bottom > fault_pg ? (bottom - fault_pg) / PGSIZE - 1 : 0;
+	size_t window, free_below;
+	int64_t now = timer_ticks ();
+
+	if (now - spt->stack_tick <= STACK_GROW_TICKS)
+		window = spt->stack_window * 2 > STACK_GROW_MAX
+			? STACK_GROW_MAX : spt->stack_window * 2;
+	else
+		window = spt->stack_window / 2 < STACK_GROW_MIN
+			? STACK_GROW_MIN : spt->stack_window / 2;
+	if (window < gap)
+		window = gap < STACK_GROW_MAX ? gap : STACK_GROW_MAX;
+	spt->stack_window = window;
+	spt->stack_tick = now;
+
+	/* Count the unmapped pages below, up to the window plus the
+	 * guard. */
+	for (free_below = 0, va = fault_pg - PGSIZE;
+			free_below < window + STACK_GUARD && va >= (uint8_t *) PGSIZE
+			&& spt_find_page (spt, va) == NULL;
+			free_below++, va -= PGSIZE)
+		continue;
+	if (free_below < STACK_GUARD)
+		return false;
+	if (window > free_below - STACK_GUARD)
+		window = free_below - STACK_GUARD;
+	if (window > (size_t) (fault_pg - limit) / PGSIZE)
+		window = (fault_pg - limit) / PGSIZE;
+
+	if (!vm_alloc_page (VM_ANON | VM_STACK, fault_pg, true))
+		return false;
+	stack_grows++;
+	stack_pages++;
+	if (fault_pg < bottom)
+		spt->stack_bottom = fault_pg;
+
+	/* The rest is only a head start: stop at the first failure. */
+	for (va = fault_pg + PGSIZE; va < bottom; va += PGSIZE)
+		if (!stack_add_page (va))
+			return true;
+	for (va = fault_pg - PGSIZE; va >= fault_pg - window * PGSIZE;
+			va -= PGSIZE) {
+		if (!stack_add_page (va))
+			break;
+		spt->stack_bottom = va;
+	}
+	return true;
+}
+
+/* Adds the stack page at VA, unless it is there already, and brings
+ * it in if there is a free frame for it.  Returns false if the page
+ * cannot be added. */
+static bool
+stack_add_page (void *va) {
+	struct page *page;
+
+	if (spt_find_page (&thread_current ()->spt, va) != NULL)
+		return true;
+	if (!vm_alloc_page (VM_ANON | VM_STACK, va, true))
+		return false;
+	stack_pages++;
+	page = spt_find_page (&thread_current ()->spt, va);
+	lock_acquire (&frame_lock);
+	claim_readahead (page, NULL);
+	lock_release (&frame_lock);
+	return true;
+}
+
+/* Handle the fault on write_protected page.  For a writable page this
+ * is a copy-on-write frame shared with a forked parent or child:
+ * the faulting page gets a private copy of the frame (or simply
+ * takes it over, when nobody else maps it any more).  A page that
+ * maps the zero page gets a fresh zeroed frame instead of a copy. */
+static bool
+vm_handle_wp (struct page *page) {
+	struct frame *old;
+	struct frame *new = NULL;
+	bool success = false;
+
+	if (!page->writable)
+		return false;
+
+	lock_acquire (&frame_lock);
+	old = page->frame;
+	if (old == NULL) {
+		/* Evicted since the fault; bring it back, writable. */
+		success = claim_locked (page);
+	} else if (old->share_cnt == 1) {
+		ksm_forget (old);
+		pml4_set_writable (page->owner->pml4, page->va, true);
+		success = true;
+	} else {
+		/* Getting a frame may evict; it must not take OLD, which
+		 * the copy is made from and PAGE still maps. */
+		old->pinned = true;
+		new = vm_get_frame (old == &zero_frame);
+		old->pinned = false;
+	}
+	if (new != NULL) {
+		if (old != &zero_frame)
+			memcpy (new->kva, old->kva, PGSIZE);
+		frame_get (new, page);
+		page->frame = new;
+		frame_put (old, page);
+		frame_table_insert (new);
+
+		/* Replace the read-only mapping; clearing it first flushes
+		 * the stale TLB entry. */
+		pml4_clear_page (page->owner->pml4, page->va);
+		success = pml4_set_page (page->owner->pml4, page->va, new->kva, true);
+		pml4_set_dirty (page->owner->pml4, page->va, true);
+	}
+	lock_release (&frame_lock);
+	return success;
 }
 
-/* Handle the fault on write_protected page */
+/* Does the work of vm_try_handle_fault(), setting *KIND to the
+ * VMSTAT_FAULT_* kind of the fault. */
 static bool
-vm_handle_wp (struct page *page UNUSED) {
+handle_fault (struct intr_frame *f, void *addr, bool user, bool write,
+		bool not_present, int *kind) {
+	struct supplemental_page_table *spt = &thread_current ()->spt;
+	struct page *page;
+
+	if (addr == NULL || !is_user_vaddr (addr))
+		return false;
+
+	page = spt_find_page (spt, addr);
+
+	/* A write to a present page that the PTE marks read-only. */
+	if (!not_present) {
+		*kind = VMSTAT_FAULT_WP;
+		return write && page != NULL && vm_handle_wp (page);
+	}
+
+	if (page == NULL) {
+		void *rsp = user ? (void *) f->rsp : thread_current ()->user_rsp;
+
+		*kind = VMSTAT_FAULT_STACK;
+		if (!is_stack_access (addr, rsp) || !vm_stack_growth (addr))
+			return false;
+		page = spt_find_page (spt, addr);
+	} else if (VM_TYPE (page->operations->type) == VM_UNINIT)
+		*kind = VMSTAT_FAULT_UNINIT;
+	else if (VM_TYPE (page->operations->type) == VM_FILE)
+		*kind = VMSTAT_FAULT_FILE;
+	else
+		*kind = page->frame != NULL ? VMSTAT_FAULT_ANON : VMSTAT_FAULT_SWAPIN;
+	if (write && !page->writable)
+		return false;
+
+	/* Reading memory nobody has written yet needs no frame. */
+	if (!write && page_starts_zeroed (page))
+		return claim_zero_page (page);
+	if (thp_enabled && page_starts_zeroed (page) && claim_huge (page))
+		return true;
+	return vm_do_claim_page (page);
 }
 
 /* Return true on success */
 bool
-vm_try_handle_fault (struct intr_frame *f UNUSED, void *addr UNUSED,
-		bool user UNUSED, bool write UNUSED, bool not_present UNUSED) {
-	struct supplemental_page_table *spt UNUSED = &thread_current ()->spt;
-	struct page *page = NULL;
-	/* TODO: Validate the fault */
-	/* TODO: Your code goes here */
+vm_try_handle_fault (struct intr_frame *f, void *addr,
+		bool user, bool write, bool not_present) {
+	uint64_t start = rdtsc ();
+	uint64_t cycles;
+	int kind = -1;
+	int bucket;
 
-	return vm_do_claim_page (page);
+	if (!handle_fault (f, addr, user, write, not_present, &kind)) {
+		bad_fault_cnt++;
+		return false;
+	}
+	cycles = rdtsc () - start;
+	for (bucket = 0; bucket < VMSTAT_HIST_CNT - 1 && cycles >> (bucket + 1);
+			bucket++)
+		continue;
+	fault_cnt[kind]++;
+	fault_cycles[bucket]++;
+	return true;
 }
 
 /* Free the page.
@@ -150,41 +1035,745 @@ vm_dealloc_page (struct page *page) {
 
 /* Claim the page that allocate on VA. */
 bool
-vm_claim_page (void *va UNUSED) {
-	struct page *page = NULL;
-	/* TODO: Fill this function */
+vm_claim_page (void *va) {
+	struct page *page = spt_find_page (&thread_current ()->spt, va);
 
+	if (page == NULL)
+		return false;
 	return vm_do_claim_page (page);
 }
 
+/* Returns true if PAGE expects an all-zero frame on its first load:
+ * an anonymous page with nothing to load into it, like the stack. */
+static bool
+page_starts_zeroed (struct page *page) {
+	return VM_TYPE (page->operations->type) == VM_UNINIT
+		&& VM_TYPE (page->uninit.type) == VM_ANON
+		&& page->uninit.init == NULL;
+}
+
+/* spt_for_each() action: counts PAGE in *CNT_ if it may become
+ * part of a huge page, and stops the walk if not. */
+static bool
+huge_candidate (struct page *page, void *cnt_) {
+	size_t *cnt = cnt_;
+
+	if (!page_starts_zeroed (page) || !page->writable)
+		return false;
+	(*cnt)++;
+	return true;
+}
+
+/* Maps the 2 MB-aligned range around PAGE, an untouched anonymous
+ * page, with a huge page, if every page of the range is an
+ * untouched writable anonymous page and an aligned run of free
+ * frames is to be had.  Never evicts to get one.  Returns true if it
+ * did. */
+static bool
+claim_huge (struct page *page) {
+	struct supplemental_page_table *spt = &page->owner->spt;
+	void *base = (void *) ((uint64_t) page->va & ~(PGSIZE_2M - 1));
+	struct list frames;
+	size_t cnt = 0, i;
+	uint64_t *pt;
+	void *kva;
+
+	if (!spt_for_each (spt, base, base + PGSIZE_2M, huge_candidate, &cnt)
+			|| cnt != HUGE_PAGE_CNT)
+		return false;
+
+	/* Before taking the frame lock, which compaction needs. */
+	kva = palloc_get_aligned (PAL_USER | PAL_ZERO, HUGE_PAGE_CNT,
+			HUGE_PAGE_CNT);
+	lock_acquire (&frame_lock);
+	pt = palloc_get_page (0);
+	list_init (&frames);
+	for (i = 0; kva != NULL && pt != NULL && i < HUGE_PAGE_CNT; i++) {
+		struct frame *frame = malloc (sizeof *frame);
+
+		if (frame == NULL)
+			break;
+		list_push_back (&frames, &frame->elem);
+	}
+	if (i < HUGE_PAGE_CNT
+			|| !pml4_set_large_page (page->owner->pml4, (uint64_t) base,
+				vtop (kva), PGSIZE_2M, PTE_U | PTE_W | PTE_D)) {
+		while (!list_empty (&frames))
+			free (list_entry (list_pop_front (&frames), struct frame, elem));
+		if (pt != NULL)
+			palloc_free_page (pt);
+		if (kva != NULL)
+			palloc_free_multiple (kva, HUGE_PAGE_CNT);
+		lock_release (&frame_lock);
+		return false;
+	}
+
+	/* The frames are zeroed already; the pages have no init. */
+	for (i = 0; i < HUGE_PAGE_CNT; i++) {
+		struct frame *frame = list_entry (list_pop_front (&frames),
+				struct frame, elem);
+		struct page *p = spt_find_page (spt, base + i * PGSIZE);
+
+		*frame = (struct frame) {
+			.kva = kva + i * PGSIZE,
+			.ksm_state = KSM_NONE,
+			.huge_pt = pt,
+		};
+		list_init (&frame->rmap);
+		frame_get (frame, p);
+		swap_in (p, frame->kva);
+		p->frame = frame;
+		frame_table_insert (frame);
+	}
+	huge_cnt++;
+	kswapd_check ();
+	lock_release (&frame_lock);
+	return true;
+}
+
+/* Splits the huge page that PAGE is part of, if any, back into 4 kB
+ * pages, which keep the huge page's accessed and dirty bits, or
+ * just frees its spare page table if the owner's page table is
+ * gone.  FRAME_LOCK must be held. */
+static void
+split_huge (struct page *page) {
+	struct frame *frame = page->frame;
+	void *base;
+	size_t i;
+
+	ASSERT (lock_held_by_current_thread (&frame_lock));
+
+	if (frame == NULL || frame->huge_pt == NULL)
+		return;
+	base = (void *) ((uint64_t) page->va & ~(PGSIZE_2M - 1));
+	if (page->owner->pml4 != NULL)
+		pml4_split_large_page (page->owner->pml4, (uint64_t) base,
+				frame->huge_pt);
+	else
+		palloc_free_page (frame->huge_pt);
+	for (i = 0; i < HUGE_PAGE_CNT; i++)
+		spt_find_page (&page->owner->spt, base + i * PGSIZE)->frame->huge_pt
+			= NULL;
+	huge_splits++;
+}
+
 /* Claim the PAGE and set up the mmu. */
 static bool
 vm_do_claim_page (struct page *page) {
-	struct frame *frame = vm_get_frame ();
+	bool success;
+
+	lock_acquire (&frame_lock);
+	success = claim_locked (page);
+	lock_release (&frame_lock);
+	return success;
+}
+
+/* Brings PAGE, a neighbor of a page just faulted in, in as well,
+ * but only into a free frame.  It is mapped with its accessed bit
+ * clear, so the clock takes it back first if it goes unused.  If
+ * DATA is not NULL, PAGE loads from a file and DATA is the page of
+ * its contents, read already.  Returns false if there was no frame
+ * to be had. */
+static bool
+claim_readahead (struct page *page, const void *data) {
+	bool first_load = VM_TYPE (page->operations->type) == VM_UNINIT;
+	struct frame *frame;
+	void *kva;
+
+	if (claim_shared (page))
+		return true;
+	kva = palloc_get_page (PAL_USER
+			| (page_starts_zeroed (page) ? PAL_ZERO : 0));
+	if (kva == NULL)
+		return false;
+	frame = malloc (sizeof *frame);
+	if (frame == NULL) {
+		palloc_free_page (kva);
+		return false;
+	}
+	frame->kva = kva;
+	frame->page = NULL;
+	list_init (&frame->rmap);
+	frame->share_cnt = 0;
+	frame->ksm_state = KSM_NONE;
+	frame->text = NULL;
+	frame->huge_pt = NULL;
+	frame->pinned = false;
+	frame_get (frame, page);
+	page->frame = frame;
+	if (data != NULL)
+		memcpy (kva, data, PGSIZE);
+
+	if ((data != NULL ? uninit_preloaded (page, kva) : swap_in (page, kva))
+			&& pml4_set_page (page->owner->pml4, page->va, kva, page->writable)) {
+		if (first_load && page_get_type (page) == VM_ANON)
+			pml4_set_dirty (page->owner->pml4, page->va, true);
+		frame_table_insert (frame);
+		file_text_add (frame, page);
+		return true;
+	}
+	page->frame = NULL;
+	rmap_remove (frame, page);
+	palloc_free_page (kva);
+	free (frame);
+	return false;
+}
+
+/* Swap readahead: PAGE just came back from swap, so read in the
+ * pages next to it whose slots are next to its slot too.  Swap-out
+ * gives neighboring pages adjacent slots, so these are likely
+ * wanted soon and cost no seek.  Pages advised MADV_SEQUENTIAL read
+ * further ahead, and only forward. */
+static void
+swap_readahead (struct page *page) {
+	struct supplemental_page_table *spt = &page->owner->spt;
+	bool sequential = page->advice == MADV_SEQUENTIAL;
+	size_t max = sequential ? FAULT_AROUND_MAX : READAHEAD_MAX;
+	size_t done = 0;
+	int dir;
+
+	for (dir = 1; dir >= (sequential ? 1 : -1); dir -= 2) {
+		long delta;
+
+		for (delta = dir; done < max; delta += dir) {
+			void *va = page->va + delta * PGSIZE;
+			struct page *n;
+
+			if (!is_user_vaddr (va))
+				break;
+			n = spt_find_page (spt, va);
+			if (n == NULL || !anon_swapped_next_to (n, page, delta))
+				break;
+			if (!claim_readahead (n, NULL))
+				return;
+			readahead_cnt++;
+			done++;
+		}
+	}
+}
+
+/* Returns true if PAGE has yet to be loaded from a file, like the
+ * pages of an executable. */
+static bool
+page_loads_from_file (struct page *page) {
+	return VM_TYPE (page->operations->type) == VM_UNINIT
+		&& (page->uninit.init != NULL
+			|| VM_TYPE (page->uninit.type) == VM_FILE);
+}
+
+/* Maps PAGE read-only onto a frame in the text cache that already
+ * holds its contents, if PAGE is a read-only file page and there is
+ * such a frame.  Returns true if it did. */
+static bool
+claim_shared (struct page *page) {
+	struct frame *frame;
+
+	ASSERT (lock_held_by_current_thread (&frame_lock));
+
+	if (page_get_type (page) != VM_FILE || page->writable)
+		return false;
+	/* Set up the file page without loading anything. */
+	if (VM_TYPE (page->operations->type) == VM_UNINIT
+			&& !swap_in (page, NULL))
+		return false;
+
+	frame = file_text_find (page);
+	if (frame == NULL
+			|| !pml4_set_page (page->owner->pml4, page->va, frame->kva, false))
+		return false;
+	page->frame = frame;
+	frame_get (frame, page);
+	return true;
+}
+
+/* Returns true if PAGE, which loads from a file like PREV, loads
+ * from the part of the same file that follows PREV's, so that both
+ * can come in with one read. */
+static bool
+load_follows (struct page *prev, struct page *page) {
+	const struct lazy_load_arg *a = prev->uninit.aux;
+	const struct lazy_load_arg *b = page->uninit.aux;
+
+	return page->uninit.init == prev->uninit.init
+		&& VM_TYPE (page->uninit.type) == VM_TYPE (prev->uninit.type)
+		&& b->ofs == a->ofs + PGSIZE
+		&& a->read_bytes == PGSIZE
+		&& file_get_inode (b->file) == file_get_inode (a->file);
+}
+
+/* Reads the contents of the CNT pages of RUN, which load_follows()
+ * one another, with one read into a buffer, and brings each page in
+ * from there with claim_readahead().  Falls back to a read per page
+ * for a single page or without memory for a buffer.  Returns the
+ * number of pages brought in, from the front of RUN. */
+static size_t
+read_run (struct page *run[], size_t cnt) {
+	const struct lazy_load_arg *first = run[0]->uninit.aux;
+	const struct lazy_load_arg *last = run[cnt - 1]->uninit.aux;
+	off_t bytes = (cnt - 1) * PGSIZE + last->read_bytes;
+	void *buf = NULL;
+	size_t i;
+
+	if (cnt > 1)
+		buf = palloc_get_multiple (0, cnt);
+	if (buf == NULL) {
+		for (i = 0; i < cnt && claim_readahead (run[i], NULL); i++)
+			continue;
+		return i;
+	}
+
+	i = 0;
+	if (file_read_at (first->file, buf, bytes, first->ofs) == bytes) {
+		memset (buf + bytes, 0, cnt * PGSIZE - bytes);
+		while (i < cnt && claim_readahead (run[i], buf + i * PGSIZE))
+			i++;
+		readaround_reads++;
+	}
+	palloc_free_multiple (buf, cnt);
+	return i;
+}
+
+/* Fault-around: PAGE was just loaded from a file, so load the pages
+ * that follow it too, while they also load from a file.  Each fault
+ * costs a trip through the kernel, and programs tend to touch their
+ * code and data in order.  Pages whose contents follow one another
+ * in the file come in with one read (see read_run()).
+ *
+ * The window adapts to the owner's faults: it doubles, up to
+ * FAULT_AROUND_MAX, when a fault lands right after the pages the
+ * last one loaded, and halves, down to FAULT_AROUND_MIN, when it
+ * does not.  Pages advised MADV_SEQUENTIAL always use the largest
+ * window. */
+static void
+fault_around (struct page *page) {
+	struct supplemental_page_table *spt = &page->owner->spt;
+	struct page *pages[FAULT_AROUND_MAX];
+	size_t cnt = 0, done = 0;
+
+	if (page->advice == MADV_SEQUENTIAL)
+		spt->fault_window = FAULT_AROUND_MAX;
+	else if (page->va == spt->fault_next)
+		spt->fault_window = spt->fault_window * 2 > FAULT_AROUND_MAX
+			? FAULT_AROUND_MAX : spt->fault_window * 2;
+	else
+		spt->fault_window = spt->fault_window / 2 < FAULT_AROUND_MIN
+			? FAULT_AROUND_MIN : spt->fault_window / 2;
+
+	/* Collect the pages to load, then load them run by run. */
+	while (cnt < spt->fault_window) {
+		void *va = page->va + (cnt + 1) * PGSIZE;
+		struct page *n;
+
+		if (!is_user_vaddr (va))
+			break;
+		n = spt_find_page (spt, va);
+		if (n == NULL || n->frame != NULL || !page_loads_from_file (n))
+			break;
+		pages[cnt++] = n;
+	}
+	while (done < cnt) {
+		size_t run_cnt = 1, got;
+
+		while (done + run_cnt < cnt
+				&& load_follows (pages[done + run_cnt - 1], pages[done + run_cnt]))
+			run_cnt++;
+		got = read_run (pages + done, run_cnt);
+		done += got;
+		if (got < run_cnt)
+			break;
+	}
+	faultaround_cnt += done;
+	spt->fault_next = page->va + (done + 1) * PGSIZE;
+}
+
+/* Maps the zero page read-only at PAGE, an anonymous page that
+ * page_starts_zeroed(), turning it into an anonymous page with no
+ * frame of its own yet. */
+static bool
+claim_zero_page (struct page *page) {
+	bool success = true;
+
+	lock_acquire (&frame_lock);
+	if (page->frame == NULL) {
+		/* Nothing is written to the frame: the page has no init. */
+		success = swap_in (page, zero_frame.kva)
+			&& pml4_set_page (page->owner->pml4, page->va, zero_frame.kva,
+					false);
+		if (success) {
+			page->frame = &zero_frame;
+			frame_get (&zero_frame, page);
+			zero_maps++;
+		}
+	}
+	lock_release (&frame_lock);
+	return success;
+}
+
+/* PAGE, advised MADV_SEQUENTIAL, was just faulted in.  Clears the
+ * accessed bits of the window of pages well behind it, so that the
+ * clock reclaims those first: a sequential reader is done with
+ * them. */
+static void
+deactivate_behind (struct page *page) {
+	size_t i;
+
+	for (i = FAULT_AROUND_MAX + 1; i <= 2 * FAULT_AROUND_MAX; i++) {
+		void *va = page->va - i * PGSIZE;
+		struct page *n;
+
+		if (va >= page->va || !is_user_vaddr (va))
+			break;
+		n = spt_find_page (&page->owner->spt, va);
+		if (n != NULL && n->frame != NULL)
+			pml4_set_accessed (n->owner->pml4, n->va, false);
+	}
+}
+
+/* Does the work of vm_do_claim_page() with FRAME_LOCK held. */
+static bool
+claim_locked (struct page *page) {
+	bool first_load = VM_TYPE (page->operations->type) == VM_UNINIT;
+	bool from_swap = VM_TYPE (page->operations->type) == VM_ANON;
+	bool from_file = page_loads_from_file (page);
+	struct frame *frame;
+
+	/* Another fault may have brought it in while we waited. */
+	if (page->frame != NULL)
+		return true;
+	if (claim_shared (page))
+		return true;
+
+	frame = vm_get_frame (page_starts_zeroed (page));
+	if (frame == NULL)
+		return false;
 
 	/* Set links */
-	frame->page = page;
+	frame->text = NULL;
+	frame_get (frame, page);
 	page->frame = frame;
 
-	/* TODO: Insert page table entry to map page's VA to frame's PA. */
+	/* Map the page only once its contents are in place. */
+	if (swap_in (page, frame->kva)
+			&& pml4_set_page (page->owner->pml4, page->va, frame->kva,
+				page->writable)) {
+		/* An anonymous page loaded for the first time has no copy in
+		 * swap yet; the dirty bit says it must be written. */
+		if (first_load && page_get_type (page) == VM_ANON)
+			pml4_set_dirty (page->owner->pml4, page->va, true);
+		frame_table_insert (frame);
+		file_text_add (frame, page);
+		if (page->advice == MADV_RANDOM)
+			return true;
+		if (from_swap)
+			swap_readahead (page);
+		else if (from_file && page->owner == thread_current ())
+			fault_around (page);
+		if (page->advice == MADV_SEQUENTIAL && page->owner == thread_current ())
+			deactivate_behind (page);
+		return true;
+	}
+
+	page->frame = NULL;
+	rmap_remove (frame, page);
+	palloc_free_page (frame->kva);
+	free (frame);
+	return false;
+}
+
+/* Sets the advice of PAGE to *ADVICE_. */
+static bool
+set_advice (struct page *page, void *advice_) {
+	page->advice = *(int *) advice_;
+	return true;
+}
+
+/* Reads PAGE in ahead of use, if it is not in memory and a free
+ * frame is to be had.  Returns false once there is none. */
+static bool
+prefetch_page (struct page *page, void *aux UNUSED) {
+	if (page->frame != NULL || page_starts_zeroed (page))
+		return true;
+	return claim_readahead (page, NULL);
+}
+
+/* Releases the memory of PAGE for MADV_DONTNEED.  An anonymous page
+ * becomes an untouched page again: a private page of a file, such as
+ * program data, reads back from the file, any other as zeros.  A
+ * clean file page gives up its frame and reads it back from the file
+ * when next touched.  An spt_for_each() action. */
+static bool
+drop_page (struct page *page, void *aux UNUSED) {
+	struct thread *owner = page->owner;
+	bool writable = page->writable;
+	int advice = page->advice;
+	vm_initializer *init;
+	struct lazy_load_arg *load;
 
-	return swap_in (page, frame->kva);
+	switch (VM_TYPE (page->operations->type)) {
+		case VM_ANON:
+			/* Keep the load information from destroy(). */
+			init = page->anon.init;
+			load = page->anon.load;
+			page->anon.load = NULL;
+			destroy (page);
+			uninit_new (page, page->va, init, VM_ANON, load, anon_initializer);
+			page->owner = owner;
+			page->writable = writable;
+			page->advice = advice;
+			break;
+		case VM_FILE:
+			if (page->frame != NULL
+					&& !pml4_is_dirty (owner->pml4, page->va))
+				vm_free_frame (page);
+			break;
+		default:
+			break;
+	}
+	return true;
+}
+
+/* Applies ADVICE, one of the MADV_* values, to the current process's
+ * pages in [ADDR, ADDR + LENGTH).  Parts of the range that nothing
+ * is mapped in are skipped.  MADV_WILLNEED reads pages in right
+ * away, but only into free frames.  Returns false if ADDR is not
+ * page-aligned, the range is not in user memory, or ADVICE is
+ * unknown. */
+bool
+vm_madvise (void *addr, size_t length, int advice) {
+	struct supplemental_page_table *spt = &thread_current ()->spt;
+	void *end = addr + length;
+
+	if (pg_ofs (addr) != 0 || end < addr || !is_user_vaddr (addr)
+			|| (length > 0 && !is_user_vaddr (end - 1)))
+		return false;
+	end = pg_round_up (end);
+
+	switch (advice) {
+		case MADV_NORMAL:
+		case MADV_RANDOM:
+		case MADV_SEQUENTIAL:
+			spt_for_each (spt, addr, end, set_advice, &advice);
+			return true;
+		case MADV_WILLNEED:
+			lock_acquire (&frame_lock);
+			spt_for_each (spt, addr, end, prefetch_page, NULL);
+			lock_release (&frame_lock);
+			return true;
+		case MADV_DONTNEED:
+			lock_acquire (&spt->lock);
+			spt_for_each (spt, addr, end, drop_page, NULL);
+			lock_release (&spt->lock);
+			return true;
+		default:
+			return false;
+	}
 }
 
 /* Initialize new supplemental page table */
 void
-supplemental_page_table_init (struct supplemental_page_table *spt UNUSED) {
+supplemental_page_table_init (struct supplemental_page_table *spt) {
+	spt->root = NULL;
+	lock_init (&spt->lock);
+	spt->fault_next = NULL;
+	spt->fault_window = FAULT_AROUND_MIN;
+	spt->stack_bottom = (void *) USER_STACK;
+	spt->stack_window = STACK_GROW_MIN;
+	spt->stack_tick = 0;
+}
+
+/* State of a supplemental_page_table_copy(). */
+struct spt_copy {
+	struct supplemental_page_table *dst;   /* The child's table. */
+	uint64_t *src_pml4;         /* The parent's page table, once known. */
+};
+
+/* Maps PAGE, a forked child's copy of SRC, read-only onto SRC's
+ * frame, claiming SRC first if it is out of memory.  FRAME_LOCK
+ * must be held.  Returns false if SRC cannot be brought in or PAGE
+ * cannot be mapped. */
+static bool
+share_frame (struct spt_copy *copy, struct page *page, struct page *src) {
+	ASSERT (lock_held_by_current_thread (&frame_lock));
+
+	if (src->frame == NULL && !claim_locked (src))
+		return false;
+	split_huge (src);
+	page->frame = src->frame;
+	frame_get (page->frame, page);
+	copy->src_pml4 = src->owner->pml4;
+	/* Map it before letting go of the lock: eviction unmaps every
+	 * page in the rmap. */
+	if (!pml4_set_page (page->owner->pml4, page->va, page->frame->kva, false)) {
+		frame_put (page->frame, page);
+		page->frame = NULL;
+		return false;
+	}
+	/* The child's page has no copy in swap of its own. */
+	pml4_set_dirty (page->owner->pml4, page->va, true);
+	return true;
+}
+
+/* Duplicates SRC, a page of the parent, into COPY_'s table, the
+ * current (child) thread's.  Pages that are not loaded yet are
+ * copied as uninit pages with their own copy of the load
+ * information.  Loaded anonymous pages share the parent's frame
+ * copy-on-write: both sides map it read-only and the first write
+ * fault copies it (see vm_handle_wp()); those out of memory share
+ * the parent's copy in zswap or swap instead.  The parent's side is
+ * write-protected afterwards, all at once. */
+static bool
+spt_copy_page (struct page *src, void *copy_) {
+	struct spt_copy *copy = copy_;
+	struct supplemental_page_table *dst = copy->dst;
+	struct page *page;
+
+	if (VM_TYPE (src->operations->type) == VM_UNINIT) {
+		void *aux = src->uninit.aux;
+
+		if (aux != NULL && (aux = lazy_load_arg_dup (aux)) == NULL)
+			return false;
+		if (!vm_alloc_page_with_initializer (src->uninit.type, src->va,
+					src->writable, src->uninit.init, aux)) {
+			if (aux != NULL)
+				lazy_load_arg_free (aux);
+			return false;
+		}
+		spt_find_page (dst, src->va)->advice = src->advice;
+		return true;
+	}
+
+	page = malloc (sizeof *page);
+	if (page == NULL)
+		return false;
+	*page = (struct page) {
+		.va = src->va,
+		.owner = thread_current (),
+		.writable = src->writable,
+		.advice = src->advice,
+	};
+	switch (VM_TYPE (src->operations->type)) {
+		case VM_ANON:
+			anon_initializer (page, VM_ANON, NULL);
+			break;
+		case VM_FILE:
+			/* The child finds the frame, if any, in the text cache on
+			 * its first fault. */
+			if (!file_page_dup (page, src)) {
+				free (page);
+				return false;
+			}
+			if (!spt_insert_page (dst, page)) {
+				vm_dealloc_page (page);
+				return false;
+			}
+			return true;
+		default:
+			NOT_REACHED ();
+	}
+
+	/* A page out of memory shares its copy in the zswap pool or in
+	 * swap: bringing it back in would, under memory pressure, only
+	 * evict other pages to make room.  Otherwise it shares the frame,
+	 * brought back in if need be. */
+	lock_acquire (&frame_lock);
+	if ((src->frame != NULL || !anon_share_swap (page, src))
+			&& !share_frame (copy, page, src)) {
+		lock_release (&frame_lock);
+		free (page);
+		return false;
+	}
+	lock_release (&frame_lock);
+
+	/* A private page of a file still knows where it came from. */
+	if (src->anon.load != NULL) {
+		page->anon.init = src->anon.init;
+		page->anon.load = lazy_load_arg_dup (src->anon.load);
+		if (page->anon.load == NULL) {
+			vm_dealloc_page (page);
+			return false;
+		}
+	}
+	if (!spt_insert_page (dst, page)) {
+		vm_dealloc_page (page);
+		return false;
+	}
+	return true;
 }
 
 /* Copy supplemental page table from src to dst */
 bool
-supplemental_page_table_copy (struct supplemental_page_table *dst UNUSED,
-		struct supplemental_page_table *src UNUSED) {
+supplemental_page_table_copy (struct supplemental_page_table *dst,
+		struct supplemental_page_table *src) {
+	/* The child reads file pages from the file, so it must have the
+	 * parent's changes. */
+	struct spt_copy copy = { dst, NULL };
+
+	dst->stack_bottom = src->stack_bottom;
+	file_writeback (src, NULL, (void *) KERN_BASE);
+	if (!spt_for_each (src, NULL, (void *) KERN_BASE, spt_copy_page, &copy))
+		return false;
+
+	/* Write-protect every page of the parent in one pass over its
+	 * page table.  Pages that nobody shares, like writable file
+	 * pages, get write access back on their first write fault. */
+	if (copy.src_pml4 != NULL)
+		pml4_protect_range (copy.src_pml4, NULL, (uint64_t) KERN_BASE / PGSIZE,
+				false);
+	return true;
+}
+
+/* Frees NODE, a node at LEVEL of a supplemental page table, along
+ * with the nodes and pages below it. */
+static void
+spt_destroy_node (struct spt_node *node, int level) {
+	size_t i;
+
+	for (i = 0; i < SPT_FANOUT; i++) {
+		if (node->slots[i] == NULL)
+			continue;
+		if (level == SPT_LEVELS - 1)
+			vm_dealloc_page (node->slots[i]);
+		else
+			spt_destroy_node (node->slots[i], level + 1);
+	}
+	free (node);
+}
+
+/* Frees the lowest leaf node of SPT, with its pages, or else a node
+ * that has been left empty, so at most SPT_FANOUT pages per call.
+ * Returns true if SPT has anything left to free.  This lets the
+ * table of a dead process be freed a bounded batch at a time. */
+bool
+supplemental_page_table_shrink (struct supplemental_page_table *spt) {
+	void **slot = &spt->root;
+	int level;
+	bool more;
+
+	lock_acquire (&spt->lock);
+	for (level = 0; *slot != NULL; level++) {
+		struct spt_node *node = *slot;
+		size_t i;
+
+		for (i = 0; i < SPT_FANOUT && node->slots[i] == NULL; i++)
+			continue;
+		if (level == SPT_LEVELS - 1 || i == SPT_FANOUT) {
+			spt_destroy_node (node, level);
+			*slot = NULL;
+			break;
+		}
+		slot = &node->slots[i];
+	}
+	more = spt->root != NULL;
+	lock_release (&spt->lock);
+	return more;
 }
 
 /* Free the resource hold by the supplemental page table */
 void
-supplemental_page_table_kill (struct supplemental_page_table *spt UNUSED) {
-	/* TODO: Destroy all the supplemental_page_table hold by thread and
-	 * TODO: writeback all the modified contents to the storage. */
+supplemental_page_table_kill (struct supplemental_page_table *spt) {
+	/* Write back the dirty file pages first, in runs; then each
+	 * page's destroy releases the frame. */
+	file_writeback (spt, NULL, (void *) KERN_BASE);
+	while (supplemental_page_table_shrink (spt))
+		continue;
 }
@@ -0,0 +1,447 @@
+/* zswap.c: Compressed in-memory cache in front of the swap disk.
+ *
+ * Anonymous pages on their way to swap are compressed into a pool of
+ * kernel pages instead, and only go to the swap disk when the pool
+ * fills up, least recently stored first.  Pages that hold one word
+ * repeated throughout, zero pages above all, take no pool space at
+ * all.  Pages that do not compress to PGSIZE * 3 / 4 or less go to
+ * disk as before.
+ *
+ * A forked child shares its parent's compressed pages: an entry
+ * lists every page whose contents it holds, and is freed when the
+ * last of them loads or drops it.
+ *
+ * The pool is off unless the kernel is given -zswap=COUNT. */
+
+#include "vm/zswap.h"
+#include <bitmap.h>
+#include <list.h>
+#include <round.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+#include "vm/vm.h"
+
+/* Pool allocation unit, in bytes. */
+#define CHUNK_SIZE 64
+
+/* Largest compressed page worth keeping. */
+#define MAX_COMPRESSED (PGSIZE * 3 / 4)
+
+size_t zswap_pool_pages;
+
+/* A compressed page. */
+struct zswap_entry {
+	struct list pages;          /* Pages whose contents these are. */
+	bool same_filled;           /* Page is VALUE repeated? */
+	uint64_t value;
+	size_t chunk;               /* First chunk in the pool. */
+	size_t chunk_cnt;           /* Number of chunks. */
+	size_t len;                 /* Compressed length in bytes. */
+	struct list_elem lru_elem;  /* In lru, unless same_filled. */
+};
+
+/* The pool, its chunks in use, and its entries from least to most
+ * recently stored.  All of zswap is protected by ZSWAP_LOCK. */
+static uint8_t *pool;
+static struct bitmap *pool_map;
+static struct list lru;
+static struct lock zswap_lock;
+
+/* Scratch space for compressing and for spilling to disk. */
+static uint8_t zbuf[MAX_COMPRESSED];
+static uint8_t spill_buf[PGSIZE];
+
+/* Statistics. */
+static long long stored_cnt;     /* Pages stored compressed. */
+static long long same_cnt;       /* ...of which same-filled. */
+static long long stored_bytes;   /* Compressed bytes stored. */
+static long long reject_cnt;     /* Pages that did not compress. */
+static long long spill_cnt;      /* Pages spilled to disk. */
+static long long load_cnt;       /* Pages loaded back. */
+
+static size_t lz_compress (const uint8_t *src, uint8_t *dst, size_t dst_max);
+static bool lz_decompress (const uint8_t *src, size_t len, uint8_t *dst);
+
+/* Sets up the pool, if one was asked for. */
+void
+zswap_init (void) {
+	lock_init (&zswap_lock);
+	list_init (&lru);
+	if (zswap_pool_pages == 0)
+		return;
+
+	pool = palloc_get_multiple (0, zswap_pool_pages);
+	pool_map = bitmap_create (zswap_pool_pages * PGSIZE / CHUNK_SIZE);
+	if (pool == NULL || pool_map == NULL) {
+		printf ("zswap: couldn't allocate a pool of %zu pages\n",
+				zswap_pool_pages);
+		if (pool != NULL)
+			palloc_free_multiple (pool, zswap_pool_pages);
+		bitmap_destroy (pool_map);
+		pool = NULL;
+		zswap_pool_pages = 0;
+	}
+}
+
+/* Prints zswap statistics. */
+void
+zswap_print_stats (void) {
+	if (pool == NULL)
+		return;
+	printf ("Zswap: %lld pages stored (%lld same-filled, %lld bytes), "
+			"%lld rejected, %lld spilled, %lld loaded\n",
+			stored_cnt, same_cnt, stored_bytes, reject_cnt, spill_cnt,
+			load_cnt);
+}
+
+/* Returns true if the page at KVA is one 64-bit word repeated, and
+ * stores the word in *VALUE. */
+static bool
+same_filled (const void *kva, uint64_t *value) {
+	const uint64_t *w = kva;
+	size_t i;
+
+	for (i = 1; i < PGSIZE / sizeof *w; i++)
+		if (w[i] != w[0])
+			return false;
+	*value = w[0];
+	return true;
+}
+
+/* Detaches PAGE from its entry, freeing the entry if no other page
+ * shares it. */
+static void
+entry_detach (struct page *page) {
+	struct zswap_entry *e = page->anon.zentry;
+
+	ASSERT (lock_held_by_current_thread (&zswap_lock));
+
+	list_remove (&page->anon.zelem);
+	page->anon.zentry = NULL;
+	if (!list_empty (&e->pages))
+		return;
+	if (!e->same_filled) {
+		list_remove (&e->lru_elem);
+		bitmap_set_multiple (pool_map, e->chunk, e->chunk_cnt, false);
+		stored_bytes -= e->len;
+	}
+	free (e);
+}
+
+/* Moves the least recently stored page in the pool out to disk.
+ * The pages sharing it share the slot it goes to.  Returns false if
+ * the pool is empty or the swap disk is full. */
+static bool
+spill_one (void) {
+	struct zswap_entry *e;
+	struct page *first = NULL;
+
+	if (list_empty (&lru))
+		return false;
+	e = list_entry (list_front (&lru), struct zswap_entry, lru_elem);
+	if (!lz_decompress (pool + e->chunk * CHUNK_SIZE, e->len, spill_buf))
+		PANIC ("zswap: corrupt entry");
+	for (;;) {
+		struct page *page = list_entry (list_front (&e->pages), struct page,
+				anon.zelem);
+		bool last = list_next (&page->anon.zelem) == list_end (&e->pages);
+
+		if ((first == NULL || !anon_share_slot (page, first))
+				&& !anon_write_slot (page, spill_buf))
+			return false;
+		if (first == NULL)
+			first = page;
+		/* Frees E after the last page. */
+		entry_detach (page);
+		if (last)
+			break;
+	}
+	spill_cnt++;
+	return true;
+}
+
+/* Stores a compressed copy of the page at KVA for PAGE, spilling
+ * older pages to disk as needed to make room.  Returns false if
+ * PAGE has to go to disk itself. */
+bool
+zswap_store (struct page *page, const void *kva) {
+	struct zswap_entry *e;
+	size_t len = 0, chunk_cnt = 0, chunk = 0;
+	uint64_t value = 0;
+	bool same;
+
+	if (pool == NULL)
+		return false;
+
+	e = malloc (sizeof *e);
+	if (e == NULL)
+		return false;
+
+	lock_acquire (&zswap_lock);
+	same = same_filled (kva, &value);
+	if (!same) {
+		len = lz_compress (kva, zbuf, MAX_COMPRESSED);
+		if (len == 0) {
+			reject_cnt++;
+			goto fail;
+		}
+		chunk_cnt = DIV_ROUND_UP (len, CHUNK_SIZE);
+		while ((chunk = bitmap_scan_and_flip (pool_map, 0, chunk_cnt, false))
+				== BITMAP_ERROR)
+			if (!spill_one ())
+				goto fail;
+		memcpy (pool + chunk * CHUNK_SIZE, zbuf, len);
+	}
+
+	*e = (struct zswap_entry) {
+		.same_filled = same,
+		.value = value,
+		.chunk = chunk,
+		.chunk_cnt = chunk_cnt,
+		.len = len,
+	};
+	if (!same) {
+		list_push_back (&lru, &e->lru_elem);
+		stored_bytes += len;
+	} else
+		same_cnt++;
+	list_init (&e->pages);
+	list_push_back (&e->pages, &page->anon.zelem);
+	page->anon.zentry = e;
+	stored_cnt++;
+	lock_release (&zswap_lock);
+	return true;
+
+fail:
+	lock_release (&zswap_lock);
+	free (e);
+	return false;
+}
+
+/* Decompresses PAGE's contents into KVA and drops the compressed
+ * copy.  Returns false if PAGE has no compressed copy. */
+bool
+zswap_load (struct page *page, void *kva) {
+	struct zswap_entry *e;
+
+	lock_acquire (&zswap_lock);
+	e = page->anon.zentry;
+	if (e == NULL) {
+		lock_release (&zswap_lock);
+		return false;
+	}
+
+	if (e->same_filled) {
+		uint64_t *w = kva;
+		size_t i;
+
+		for (i = 0; i < PGSIZE / sizeof *w; i++)
+			w[i] = e->value;
+	} else if (!lz_decompress (pool + e->chunk * CHUNK_SIZE, e->len, kva))
+		PANIC ("zswap: corrupt entry");
+	entry_detach (page);
+	load_cnt++;
+	lock_release (&zswap_lock);
+	return true;
+}
+
+/* Drops PAGE's compressed copy, if it has one, and returns true if
+ * it did.  If it does not, any copy it had has gone to disk and its
+ * swap slot is set. */
+bool
+zswap_invalidate (struct page *page) {
+	bool had = false;
+
+	lock_acquire (&zswap_lock);
+	if (page->anon.zentry != NULL) {
+		entry_detach (page);
+		had = true;
+	}
+	lock_release (&zswap_lock);
+	return had;
+}
+
+/* Makes PAGE, a forked child's copy of SRC, share SRC's compressed
+ * copy, and returns true, if SRC has one. */
+bool
+zswap_share (struct page *page, struct page *src) {
+	struct zswap_entry *e;
+
+	lock_acquire (&zswap_lock);
+	e = src->anon.zentry;
+	if (e != NULL) {
+		list_push_back (&e->pages, &page->anon.zelem);
+		page->anon.zentry = e;
+	}
+	lock_release (&zswap_lock);
+	return e != NULL;
+}
+
+/* LZ compression.
+ *
+ * A compressed page is a series of sequences, each a token byte,
+ * literals, and a match.  The token's high nibble is the number of
+ * literals and its low nibble the match length minus 4; a nibble of
+ * 15 is followed by bytes to add to it, up to and including the
+ * first byte that is not 255.  The match is a 2-byte little-endian
+ * offset back into the output, then the bytes to copy from there.
+ * The last sequence ends after its literals. */
+
+#define LZ_MIN_MATCH 4
+#define LZ_HASH_BITS 12
+
+/* Last position + 1 of each hashed 4-byte string, 0 if none. */
+static uint16_t lz_table[1 << LZ_HASH_BITS];
+
+static inline uint32_t
+lz_read32 (const uint8_t *p) {
+	uint32_t v;
+	memcpy (&v, p, sizeof v);
+	return v;
+}
+
+static inline size_t
+lz_hash (uint32_t v) {
+	return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+/* Writes the extra length bytes for LEN, a nibble of 15 or more,
+ * at OP.  Returns the new OP, or NULL if OEND is reached. */
+static uint8_t *
+lz_put_len (uint8_t *op, uint8_t *oend, size_t len) {
+	for (len -= 15; ; len -= 255) {
+		if (op >= oend)
+			return NULL;
+		if (len < 255) {
+			*op++ = len;
+			return op;
+		}
+		*op++ = 255;
+	}
+}
+
+/* Writes a sequence of LIT_LEN literals from LIT followed by a
+ * match of MATCH_LEN bytes OFFSET back, or no match if MATCH_LEN is
+ * 0.  Returns the new OP, or NULL if OEND is reached. */
+static uint8_t *
+lz_put_seq (uint8_t *op, uint8_t *oend, const uint8_t *lit, size_t lit_len,
+		size_t offset, size_t match_len) {
+	size_t m = match_len ? match_len - LZ_MIN_MATCH : 0;
+	uint8_t *token = op++;
+
+	if (op > oend)
+		return NULL;
+	*token = (lit_len < 15 ? lit_len : 15) << 4 | (m < 15 ? m : 15);
+	if (lit_len >= 15 && (op = lz_put_len (op, oend, lit_len)) == NULL)
+		return NULL;
+	if ((size_t) (oend - op) < lit_len)
+		return NULL;
+	memcpy (op, lit, lit_len);
+	op += lit_len;
+	if (match_len == 0)
+		return op;
+
+	if (oend - op < 2)
+		return NULL;
+	*op++ = offset;
+	*op++ = offset >> 8;
+	if (m >= 15 && (op = lz_put_len (op, oend, m)) == NULL)
+		return NULL;
+	return op;
+}
+
+/* Compresses the page at SRC into DST.  Returns the compressed
+ * length, or 0 if it would exceed DST_MAX bytes. */
+static size_t
+lz_compress (const uint8_t *src, uint8_t *dst, size_t dst_max) {
+	const uint8_t *end = src + PGSIZE;
+	const uint8_t *ip = src, *anchor = src;
+	uint8_t *op = dst, *oend = dst + dst_max;
+
+	memset (lz_table, 0, sizeof lz_table);
+	while (ip + LZ_MIN_MATCH <= end) {
+		uint32_t v = lz_read32 (ip);
+		size_t h = lz_hash (v);
+		size_t last = lz_table[h];
+		const uint8_t *ref = src + (last ? last - 1 : 0);
+		const uint8_t *mp;
+
+		lz_table[h] = ip - src + 1;
+		if (last == 0 || lz_read32 (ref) != v) {
+			ip++;
+			continue;
+		}
+
+		for (mp = ip + LZ_MIN_MATCH; mp < end && *mp == ref[mp - ip]; mp++)
+			continue;
+		op = lz_put_seq (op, oend, anchor, ip - anchor, ip - ref, mp - ip);
+		if (op == NULL)
+			return 0;
+		ip = anchor = mp;
+	}
+
+	op = lz_put_seq (op, oend, anchor, end - anchor, 0, 0);
+	return op != NULL ? (size_t) (op - dst) : 0;
+}
+
+/* Reads the extra length bytes at *IP into *LEN.  Returns false if
+ * they run past IEND. */
+static bool
+lz_get_len (const uint8_t **ip, const uint8_t *iend, size_t *len) {
+	uint8_t b;
+
+	do {
+		if (*ip >= iend)
+			return false;
+		b = *(*ip)++;
+		*len += b;
+	} while (b == 255);
+	return true;
+}
+
+/* Decompresses the LEN bytes at SRC into the page at DST.  Returns
+ * false if they do not make up exactly one page. */
+static bool
+lz_decompress (const uint8_t *src, size_t len, uint8_t *dst) {
+	const uint8_t *ip = src, *iend = src + len;
+	uint8_t *op = dst, *oend = dst + PGSIZE;
+
+	while (ip < iend) {
+		uint8_t token = *ip++;
+		size_t lit_len = token >> 4;
+		size_t match_len = token & 15;
+		size_t offset;
+		const uint8_t *ref;
+
+		if (lit_len == 15 && !lz_get_len (&ip, iend, &lit_len))
+			return false;
+		if (lit_len > (size_t) (iend - ip) || lit_len > (size_t) (oend - op))
+			return false;
+		memcpy (op, ip, lit_len);
+		op += lit_len;
+		ip += lit_len;
+		if (ip == iend)
+			break;
+
+		if (iend - ip < 2)
+			return false;
+		offset = ip[0] | ip[1] << 8;
+		ip += 2;
+		if (match_len == 15 && !lz_get_len (&ip, iend, &match_len))
+			return false;
+		match_len += LZ_MIN_MATCH;
+		if (offset == 0 || offset > (size_t) (op - dst)
+				|| match_len > (size_t) (oend - op))
+			return false;
+
+		/* The match may overlap what it produces. */
+		for (ref = op - offset; match_len-- > 0; )
+			*op++ = *ref++;
+	}
+	return op == oend;
+}